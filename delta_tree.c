@@ -180,6 +180,7 @@ int main(int argc, char **argv)
 	unsigned long sample_rate = 0;
 	unsigned long seed_len = 0;
 	unsigned long hash_size = 0;
+	unsigned long thread_count = 0;
 	unsigned int patch_to_stdout = 0;
 
 #define DUMP_USAGE(exit_code) \
@@ -205,6 +206,11 @@ int main(int argc, char **argv)
 			if (hash_size == 0 || hash_size > MAX_HASH_SIZE)
 				DUMP_USAGE(EXIT_USAGE);
 			break;
+		case OTHREADS:
+			thread_count = atol(optarg);
+			if (thread_count == 0 || thread_count > MAX_THREAD_COUNT)
+				DUMP_USAGE(EXIT_USAGE);
+			break;
 		case OSTDOUT:
 			patch_to_stdout = 1;
 			break;
@@ -304,13 +310,14 @@ int main(int argc, char **argv)
 	}
 
 	dcb_lprintf(1, "using patch format %lu\n", patch_id);
-	dcb_lprintf(1, "using seed_len(%lu), sample_rate(%lu), hash_size(%lu)\n",
-				seed_len, sample_rate, hash_size);
+	dcb_lprintf(1, "using seed_len(%lu), sample_rate(%lu), hash_size(%lu), threads(%lu)\n",
+				seed_len, sample_rate, hash_size, thread_count);
 	dcb_lprintf(1, "dcb: verbosity level(%u)\n", diffball_get_logging_level());
 	dcb_lprintf(1, "cfile: verbosity level(%u)\n", cfile_get_logging_level());
 	dcb_lprintf(1, "initializing Command Buffer...\n");
 
-	encode_result = simple_difference(&ref_cfh, &ver_cfh, &out_cfh, patch_id, seed_len, sample_rate, hash_size);
+	encode_result = simple_difference(&ref_cfh, &ver_cfh, &out_cfh, patch_id, seed_len, sample_rate, hash_size, thread_count,
+									   NULL, 0);
 	dcb_lprintf(1, "flushing and closing out file\n");
 	cclose(&out_cfh);
 	close(out_fh);
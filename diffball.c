@@ -13,6 +13,7 @@
 #include <diffball/dcbuffer.h>
 #include <diffball/hash.h>
 #include <diffball/diff-algs.h>
+#include <diffball/tune.h>
 #include <diffball/formats.h>
 #include <diffball/defs.h>
 #include <diffball/errors.h>
@@ -42,7 +43,8 @@ int main(int argc, char **argv)
 	signed long encode_result = 0;
 	unsigned long x, patch_format_id;
 	char src_common[512], trg_common[512], *p; /* common dir's... */
-	long sample_rate = 0, seed_len = 0, hash_size = 0;
+	long sample_rate = 0, seed_len = 0, hash_size = 0, thread_count = 1;
+	diff_tuning tune;
 
 	cfile ref_full, ref_window, ver_window, ver_full, out_cfh;
 	memset(&ref_full, 0, sizeof(cfile));
@@ -53,6 +55,8 @@ int main(int argc, char **argv)
 
 	struct stat ref_stat, ver_stat;
 	RefHash rhash_win;
+	RefHashIndex index;
+	char *index_path = NULL;
 	CommandBuffer dcbuff;
 
 	int optr;
@@ -64,12 +68,14 @@ int main(int argc, char **argv)
 		STD_LONG_OPTIONS,
 		DIFF_LONG_OPTIONS,
 		FORMAT_LONG_OPTION("patch-format", 'f'),
+		FORMAT_LONG_OPTION("index", 'i'),
 		END_LONG_OPTS};
 
 	static struct usage_options help_opts[] = {
 		STD_HELP_OPTIONS,
 		DIFF_HELP_OPTIONS,
 		FORMAT_HELP_OPTION("patch-format", 'f', "specify the generated patches format"),
+		FORMAT_HELP_OPTION("index", 'i', "reuse the reference hashes stored in this file, creating or refreshing it as needed"),
 		USAGE_FLUFF("Diffball expects normally 3 args- the source file, the target file,\n"
 					"and the name for the new patch.  If it's told to output to stdout, it will- in which\n"
 					"case only 2 non-options arguements are allowed.\n"
@@ -78,7 +84,7 @@ int main(int argc, char **argv)
 
 #define DUMP_USAGE(exit_code) \
 	print_usage("diffball", "src_file trg_file [patch_file|or to stdout]", help_opts, exit_code)
-	char short_opts[] = STD_SHORT_OPTIONS DIFF_SHORT_OPTIONS "f:";
+	char short_opts[] = STD_SHORT_OPTIONS DIFF_SHORT_OPTIONS "f:i:";
 
 	while ((optr = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1)
 	{
@@ -90,6 +96,9 @@ int main(int argc, char **argv)
 		case 'f':
 			patch_format = optarg;
 			break;
+		case 'i':
+			index_path = optarg;
+			break;
 		case OSTDOUT:
 			output_to_stdout = 1;
 			break;
@@ -108,6 +117,11 @@ int main(int argc, char **argv)
 			if (seed_len == 0 || seed_len > MAX_SEED_LEN)
 				DUMP_USAGE(EXIT_USAGE);
 			break;
+		case OTHREADS:
+			thread_count = atol(optarg);
+			if (thread_count <= 0 || thread_count > MAX_THREAD_COUNT)
+				DUMP_USAGE(EXIT_USAGE);
+			break;
 		default:
 			dcb_lprintf(0, "invalid arg- %s\n", argv[optind]);
 			DUMP_USAGE(EXIT_USAGE);
@@ -164,30 +178,33 @@ int main(int argc, char **argv)
 	{
 		DUMP_USAGE(EXIT_USAGE);
 	}
-	if (hash_size == 0)
-	{
-		hash_size = MIN(DEFAULT_MAX_HASH_COUNT, ref_stat.st_size);
-	}
-
 	if (copen_path(&ref_full, src_file, NO_COMPRESSOR, CFILE_RONLY) ||
 		copen_path(&ver_full, trg_file, NO_COMPRESSOR, CFILE_RONLY))
 	{
 		dcb_lprintf(0, "error opening file; exiting\n");
 		exit(1);
 	}
+	if (index_path)
+	{
+		err = RHash_index_open(&index, &ref_full, index_path);
+		check_return2(err, "RHash_index_open");
+	}
 
 	if (seed_len == 0)
 	{
 		seed_len = DEFAULT_SEED_LEN;
 	}
-	if (sample_rate == 0)
-	{
-		sample_rate = COMPUTE_SAMPLE_RATE(hash_size, cfile_len(&ref_full), seed_len);
-	}
+	tune.mem_budget = 0;
+	tune.seed_len = seed_len;
+	tune.sample_rate = sample_rate;
+	tune.hash_size = hash_size;
+	diff_tune(&tune, cfile_len(&ref_full), cfile_len(&ver_full));
+	hash_size = tune.hash_size;
+	sample_rate = tune.sample_rate;
 
 	dcb_lprintf(1, "using patch format %lu\n", patch_format_id);
-	dcb_lprintf(1, "using seed_len(%lu), sample_rate(%lu), hash_size(%lu)\n",
-				seed_len, sample_rate, hash_size);
+	dcb_lprintf(1, "using seed_len(%lu), sample_rate(%lu), hash_size(%lu), threads(%lu)\n",
+				seed_len, sample_rate, hash_size, thread_count);
 	dcb_lprintf(1, "dcb verbosity level(%u)\n", diffball_get_logging_level());
 	dcb_lprintf(1, "cfile logging level(%u)\n", cfile_get_logging_level());
 
@@ -335,13 +352,25 @@ int main(int argc, char **argv)
 			copen_child_cfh(&ref_window, &ref_full, tar_ptr->start, tar_ptr->end,
 							NO_COMPRESSOR, CFILE_RONLY | CFILE_BUFFER_ALL);
 
-			err = rh_bucket_hash_init(&rhash_win, &ref_window, 24, 1, 0);
-			check_return2(err, "init_RefHash");
-			err = RHash_insert_block(&rhash_win, &ref_window, 0,
-									 cfile_len(&ref_window));
-			check_return2(err, "RHash_insert_block");
-			err = RHash_cleanse(&rhash_win);
-			check_return2(err, "RHash_cleanse");
+			err = (index_path ? RHash_index_load(&index, &rhash_win, &ref_window, tar_ptr->start, tar_ptr->end, 24, 1,
+												 RH_SAMPLE_STRIDE, RH_BUCKET_HASH, 0)
+							  : 0);
+			if (err < 0)
+				check_return2(err, "RHash_index_load");
+			if (err == 0)
+			{
+				err = rh_bucket_hash_init(&rhash_win, &ref_window, 24, 1, 0);
+				check_return2(err, "init_RefHash");
+				err = RHash_insert_block(&rhash_win, &ref_window, 0,
+										 cfile_len(&ref_window));
+				check_return2(err, "RHash_insert_block");
+				err = RHash_cleanse(&rhash_win);
+				check_return2(err, "RHash_cleanse");
+				err = RHash_freeze(&rhash_win);
+				check_return2(err, "RHash_freeze");
+				if (index_path && RHash_index_store(&index, &rhash_win, tar_ptr->start, tar_ptr->end, RH_BUCKET_HASH, 0))
+					dcb_lprintf(0, "failed storing hash for %.255s in the index, continuing\n", tar_ptr->fullname);
+			}
 			print_RefHash_stats(&rhash_win);
 			err = OneHalfPassCorrecting(&dcbuff, &rhash_win, ref_id, &ver_window, ver_id);
 
@@ -354,6 +383,7 @@ int main(int argc, char **argv)
 				dcb_lprintf(0, "please contact the author so this can be resolved.\n");
 				check_return2(err, "OneHalfPassCorrecting");
 			}
+			print_RefHash_match_stats(&rhash_win);
 			err = free_RefHash(&rhash_win);
 			check_return(err, "free_RefHash", "This shouldn't be happening...");
 			cclose(&ver_window);
@@ -372,7 +402,11 @@ int main(int argc, char **argv)
 	free(target);
 
 	dcb_lprintf(1, "beginning search for gaps, and unprocessed files\n");
-	err = MultiPassAlg(&dcbuff, &ref_full, ref_id, &ver_full, ver_id, hash_size, 512);
+	if (index_path && RHash_index_close(&index))
+	{
+		dcb_lprintf(0, "failed writing index %s\n", index_path);
+	}
+	err = MultiPassAlg(&dcbuff, &ref_full, ref_id, &ver_full, ver_id, hash_size, 0, 512, thread_count, NULL);
 	check_return(err, "MultiPassAlg", "final multipass run failed");
 	err = DCB_finalize(&dcbuff);
 	check_return2(err, "DCB_finalize");
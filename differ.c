@@ -19,18 +19,114 @@ struct option long_opts[] = {
 	STD_LONG_OPTIONS,
 	DIFF_LONG_OPTIONS,
 	FORMAT_LONG_OPTION("patch-format", 'f'),
+	FORMAT_LONG_OPTION("index", 'i'),
+	{"batch", 0, 0, 'B'},
+	FORMAT_LONG_OPTION("window", 'W'),
+	FORMAT_LONG_OPTION("memory", 'M'),
 	END_LONG_OPTS};
 
 struct usage_options help_opts[] = {
 	STD_HELP_OPTIONS,
 	DIFF_HELP_OPTIONS,
 	FORMAT_HELP_OPTION("patch-format", 'f', "format to output the patch in"),
+	FORMAT_HELP_OPTION("index", 'i', "reuse the reference hash stored in this file, creating or refreshing it as needed"),
+	FORMAT_HELP_OPTION("batch", 'B', "diff many targets against the source; args are source, then target/patch pairs"),
+	FORMAT_HELP_OPTION("window", 'W', "stream the diff, searching this many MiB of the source at a time (at most half of --memory)"),
+	FORMAT_HELP_OPTION("memory", 'M', "keep memory use near this many MiB (default half the memory limit; 128 when streaming)"),
 	USAGE_FLUFF("differ expects 3 args- source, target, name for the patch\n"
 				"if output to stdout is enabled, only 2 args required- source, target\n"
+				"in batch mode, any number of target/patch pairs may follow the source; --threads\n"
+				"then controls how many targets are differenced at once\n"
+				"hash size, sample rate and seed length not given are picked to fit --memory\n"
+				"streaming (--window, or gdiff output w/ too little --memory for anything else)\n"
+				"trades patch size for memory that doesn't grow with the inputs\n"
 				"Example usage: differ older-version newerer-version upgrade-patch"),
 	END_HELP_OPTS};
 
-char short_opts[] = STD_SHORT_OPTIONS DIFF_SHORT_OPTIONS "f:";
+char short_opts[] = STD_SHORT_OPTIONS DIFF_SHORT_OPTIONS "f:i:BW:M:";
+
+/* open each remaining target/patch pair, and diff them all against ref_cfh in one go. */
+static int
+differ_batch(cfile *ref_cfh, int argc, char **argv, unsigned long patch_id, unsigned long seed_len,
+			 unsigned long hash_size, unsigned long thread_count, char *index_path, unsigned long mem_budget)
+{
+	cfile *ver_cfhs, *out_cfhs, **ver_ptrs, **out_ptrs;
+	char **patch_names;
+	int *out_fhs, *results;
+	unsigned int x, count = 0, failed = 0;
+	char *trg_file;
+
+	ver_cfhs = (cfile *)calloc(argc, sizeof(cfile));
+	out_cfhs = (cfile *)calloc(argc, sizeof(cfile));
+	ver_ptrs = (cfile **)calloc(argc, sizeof(cfile *));
+	out_ptrs = (cfile **)calloc(argc, sizeof(cfile *));
+	patch_names = (char **)calloc(argc, sizeof(char *));
+	out_fhs = (int *)calloc(argc, sizeof(int));
+	results = (int *)calloc(argc, sizeof(int));
+	if (!ver_cfhs || !out_cfhs || !ver_ptrs || !out_ptrs || !patch_names || !out_fhs || !results)
+	{
+		dcb_lprintf(0, "alloc failure for batch targets\n");
+		exit(EXIT_FAILURE);
+	}
+	while ((trg_file = (char *)get_next_arg(argc, argv)) != NULL)
+	{
+		if ((patch_names[count] = (char *)get_next_arg(argc, argv)) == NULL)
+		{
+			dcb_lprintf(0, "target %s has no patch file to go with it\n", trg_file);
+			exit(EXIT_USAGE);
+		}
+		if (copen_path(ver_cfhs + count, trg_file, NO_COMPRESSOR, CFILE_RONLY))
+		{
+			dcb_lprintf(0, "Must specify an existing target file- %s\n", trg_file);
+			exit(EXIT_USAGE);
+		}
+		if ((out_fhs[count] = open(patch_names[count], O_WRONLY | O_TRUNC | O_CREAT, 0644)) == -1)
+		{
+			dcb_lprintf(0, "error creating patch file '%s' (open failed)\n", patch_names[count]);
+			exit(1);
+		}
+		if (copen_dup_fd(out_cfhs + count, out_fhs[count], 0, 0, NO_COMPRESSOR, CFILE_WONLY))
+		{
+			dcb_lprintf(0, "error allocing needed memory for output, exiting\n");
+			exit(EXIT_FAILURE);
+		}
+		ver_ptrs[count] = ver_cfhs + count;
+		out_ptrs[count] = out_cfhs + count;
+		count++;
+	}
+	if (count == 0)
+	{
+		dcb_lprintf(0, "batch mode needs at least one target/patch pair\n");
+		exit(EXIT_USAGE);
+	}
+
+	dcb_lprintf(1, "differencing %u targets, seed_len(%lu), hash_size(%lu), threads(%lu)\n",
+				count, seed_len, hash_size, thread_count);
+	check_return2(simple_difference_batch(ref_cfh, ver_ptrs, out_ptrs, count, patch_id, seed_len, hash_size,
+										  thread_count, index_path, mem_budget, results),
+				  "simple_difference_batch");
+	for (x = 0; x < count; x++)
+	{
+		cclose(out_cfhs + x);
+		close(out_fhs[x]);
+		cclose(ver_cfhs + x);
+		if (results[x])
+		{
+			dcb_lprintf(0, "failed generating %s: ", patch_names[x]);
+			print_error(results[x]);
+			unlink(patch_names[x]);
+			failed++;
+		}
+	}
+	free(ver_cfhs);
+	free(out_cfhs);
+	free(ver_ptrs);
+	free(out_ptrs);
+	free(patch_names);
+	free(out_fhs);
+	free(results);
+	return failed;
+}
 
 int main(int argc, char **argv)
 {
@@ -44,13 +140,19 @@ int main(int argc, char **argv)
 	char *src_file = NULL;
 	char *trg_file = NULL;
 	char *patch_name = NULL;
+	char *index_path = NULL;
 	unsigned long patch_id = 0;
 	signed long encode_result = 0;
 	int err;
 	unsigned long sample_rate = 0;
 	unsigned long seed_len = 0;
 	unsigned long hash_size = 0;
+	unsigned long thread_count = 0;
 	unsigned int output_to_stdout = 0;
+	unsigned int batch = 0;
+	unsigned long window_len = 0;
+	unsigned long mem_budget = 0;
+	unsigned int stream = 0;
 
 #define DUMP_USAGE(exit_code) \
 	print_usage("differ", "src_file trg_file [patch_file|or to stdout]", help_opts, exit_code);
@@ -79,6 +181,13 @@ int main(int argc, char **argv)
 			if (hash_size == 0 || hash_size > MAX_HASH_SIZE) {
                 dcb_lprintf(0, "hash_size must be less than %u\n\n", MAX_HASH_SIZE);
                 DUMP_USAGE(EXIT_USAGE);
+            }
+			break;
+		case OTHREADS:
+			thread_count = atol(optarg);
+			if (thread_count == 0 || thread_count > MAX_THREAD_COUNT) {
+                dcb_lprintf(0, "thread count must be between 1 and %u\n\n", MAX_THREAD_COUNT);
+                DUMP_USAGE(EXIT_USAGE);
             }
 			break;
 		case OSTDOUT:
@@ -87,6 +196,29 @@ int main(int argc, char **argv)
 		case 'f':
 			patch_format = optarg;
 			break;
+		case 'i':
+			index_path = optarg;
+			break;
+		case 'B':
+			batch = 1;
+			break;
+		case 'W':
+			window_len = atol(optarg);
+			if (window_len == 0 || window_len > MAX_STREAM_MB) {
+				dcb_lprintf(0, "window must be between 1 and %u MiB\n\n", MAX_STREAM_MB);
+				DUMP_USAGE(EXIT_USAGE);
+			}
+			window_len <<= 20;
+			stream = 1;
+			break;
+		case 'M':
+			mem_budget = atol(optarg);
+			if (mem_budget == 0 || mem_budget > MAX_STREAM_MB) {
+				dcb_lprintf(0, "memory must be between 1 and %u MiB\n\n", MAX_STREAM_MB);
+				DUMP_USAGE(EXIT_USAGE);
+			}
+			mem_budget <<= 20;
+			break;
 		default:
 			dcb_lprintf(0, "invalid arg- %s\n", argv[optind]);
 			DUMP_USAGE(EXIT_USAGE);
@@ -110,6 +242,28 @@ int main(int argc, char **argv)
 		}
 		DUMP_USAGE(EXIT_USAGE);
 	}
+	if (stream && (batch || index_path))
+	{
+		dcb_lprintf(0, "streaming can't be combined w/ batch mode or an index\n");
+		DUMP_USAGE(EXIT_USAGE);
+	}
+	if (batch)
+	{
+		if (output_to_stdout)
+		{
+			dcb_lprintf(0, "batch mode can't output to stdout\n");
+			DUMP_USAGE(EXIT_USAGE);
+		}
+		patch_id = (patch_format == NULL ? DEFAULT_PATCH_ID : check_for_format(patch_format, strlen(patch_format)));
+		if (patch_id == 0)
+		{
+			dcb_lprintf(0, "Unknown format '%s'\n", patch_format);
+			exit(EXIT_FAILURE);
+		}
+		err = differ_batch(&ref_cfh, argc, argv, patch_id, seed_len, hash_size, thread_count, index_path, mem_budget);
+		cclose(&ref_cfh);
+		return (err ? EXIT_FAILURE : 0);
+	}
 	err = 0;
 	if (((trg_file = (char *)get_next_arg(argc, argv)) == NULL) ||
 		(err = copen_path(&ver_cfh, trg_file, NO_COMPRESSOR, CFILE_RONLY)) != 0)
@@ -167,13 +321,23 @@ int main(int argc, char **argv)
 	}
 
 	dcb_lprintf(1, "using patch format %lu\n", patch_id);
-	dcb_lprintf(1, "using seed_len(%lu), sample_rate(%lu), hash_size(%lu)\n",
-				seed_len, sample_rate, hash_size);
+	dcb_lprintf(1, "using seed_len(%lu), sample_rate(%lu), hash_size(%lu), threads(%lu)\n",
+				seed_len, sample_rate, hash_size, thread_count);
 	dcb_lprintf(1, "DCB verbosity level(%u)\n", diffball_get_logging_level());
 	dcb_lprintf(1, "cfile verbosity level(%u)\n", cfile_get_logging_level());
 	dcb_lprintf(1, "initializing Command Buffer...\n");
 
-	encode_result = simple_difference(&ref_cfh, &ver_cfh, &out_cfh, patch_id, seed_len, sample_rate, hash_size);
+	if (stream)
+	{
+		dcb_lprintf(1, "streaming w/ window(%lu), memory(%lu)\n", window_len, mem_budget);
+		encode_result = simple_difference_stream(&ref_cfh, &ver_cfh, &out_cfh, patch_format == NULL ? 0 : patch_id,
+												 seed_len, window_len, mem_budget);
+	}
+	else
+	{
+		encode_result = simple_difference(&ref_cfh, &ver_cfh, &out_cfh, patch_id, seed_len, sample_rate, hash_size,
+										  thread_count, index_path, mem_budget);
+	}
 	dcb_lprintf(1, "flushing and closing out file\n");
 	cclose(&out_cfh);
 	close(out_fh);
@@ -20,6 +20,15 @@ int init_adler32_seed(ADLER32_SEED_CTX *ads, unsigned int seed_len);
 
 unsigned int free_adler32_seed(ADLER32_SEED_CTX *ads);
 
+// max positions adler32_roll_block is handed at once by the diff loops.
+#define ADLER32_BLOCK_LEN (64)
+
+/* roll the checksum across len bytes of buff, storing the checksum after each byte in chksums.
+   The seed_len bytes immediately preceding buff must be the current seed- this reads the
+   outgoing bytes straight from memory rather than from seed_chars. */
+void adler32_roll_block(ADLER32_SEED_CTX *ads, const unsigned char *buff, unsigned long len,
+                        unsigned long *chksums);
+
 #ifdef DIFFBALL_ENABLE_INLINE
 inline void
 update_adler32_seed(ADLER32_SEED_CTX *ads, unsigned char *buff,
@@ -49,7 +58,8 @@ update_adler32_seed(ADLER32_SEED_CTX *ads, unsigned char *buff,
                         ads->s2 += ads->s1;
 
                         ads->seed_chars[ads->tail] = buff[x];
-                        ads->tail = (ads->tail + 1) % ads->seed_len;
+                        if (++ads->tail == ads->seed_len)
+                                ads->tail = 0;
                 }
         }
 };
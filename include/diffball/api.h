@@ -4,8 +4,25 @@
 #ifndef HEADER_API_
 #define HEADER_API_ 1
 
+/* zero for seed_len, sample_rate, hash_size or mem_budget has it picked by diff_tune; w/out a
+   mem_budget, half the memory limit is budgeted for.  A gdiff patch_id is streamed if nothing
+   else fits. */
 int simple_difference(cfile *ref, cfile *ver, cfile *out, unsigned int patch_id, unsigned long seed_len,
-					  unsigned long sample_rate, unsigned long hash_size);
+					  unsigned long sample_rate, unsigned long hash_size, unsigned int thread_count,
+					  const char *index_path, unsigned long mem_budget);
+
+/* diff ver_count targets against one reference, building the reference hash once and spreading
+   the targets over thread_count workers.  results[x] gets the outcome for ver_cfhs[x]. */
+int simple_difference_batch(cfile *ref, cfile *ver[], cfile *out[], unsigned int ver_count,
+							unsigned int patch_id, unsigned long seed_len, unsigned long hash_size,
+							unsigned int thread_count, const char *index_path, unsigned long mem_budget,
+							int results[]);
+
+/* diff w/ memory bounded by mem_budget rather than input size, writing the patch as it goes.  Only
+   window_len of the reference near the current version position is searched, so patches are
+   larger than simple_difference's; 0 for either size picks a default.  gdiff formats only. */
+int simple_difference_stream(cfile *ref, cfile *ver, cfile *out, unsigned int patch_id, unsigned long seed_len,
+							 unsigned long window_len, unsigned long mem_budget);
 
 int simple_reconstruct(cfile *src_cfh, cfile *patch_cfh[], unsigned char patch_count, cfile *out_cfh, unsigned int force_patch_id,
 					   unsigned int max_buff_size);
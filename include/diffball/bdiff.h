@@ -6,6 +6,8 @@
 #define BDIFF_MAGIC_LEN 5
 #define BDIFF_VERSION 'a'
 #define BDIFF_DEFAULT_MAXBLOCKSIZE (1 << 20)
+// offsets and lengths are 4 bytes.
+#define BDIFF_MAX_VALUE (0xffffffffULL)
 #include <diffball/diff-algs.h>
 #include <cfile.h>
 
@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (C) 2003-2015 Brian Harring <ferringb@gmail.com>
+#ifndef _HEADER_CDC
+#define _HEADER_CDC 1
+
+#include <cfile.h>
+#include <diffball/defs.h>
+
+/* content defined chunk bounds; FastCDC style normalized chunking, so most chunks land near the
+   average and an edit only moves the boundaries around it. */
+#define CDC_MIN_CHUNK (2048)
+#define CDC_AVG_CHUNK (8192)
+#define CDC_MAX_CHUNK (65536)
+
+typedef struct
+{
+	unsigned long long fp;
+	off_u64 offset;
+	unsigned long len;
+} cdc_chunk;
+
+/* split cfh's contents into chunks, filling *chunks (caller frees) and *count.  fp is a
+   fingerprint of the chunk's content; equal content means equal fp, not the reverse. */
+signed int cdc_chunk_cfile(cfile *cfh, cdc_chunk **chunks, unsigned long *count);
+
+#endif
@@ -19,8 +19,11 @@
 #define DCBUFFER_MATCHES_TYPE 0x2
 #define DCBUFFER_LLMATCHES_TYPE 0x4
 #define DCBUFFER_BUFFERLESS_TYPE 0x8
+#define DCBUFFER_STREAM_TYPE 0x10
 
 #define DCB_LLM_FINALIZED 0x2
+// the gap last handed out by DCB_get_next_gap is still where a finalize can split it.
+#define DCB_LLM_GAP_RETURNED 0x4
 
 /* register_src flags */
 #define DCB_FREE_SRC_CFH (char)0x1
@@ -47,15 +50,6 @@ typedef signed int EDCB_SRC_ID;
 // internal dcbuffer macros.
 #define LLM_VEND(l) ((l)->ver_pos + (l)->len)
 
-typedef struct LL_DCLmatch LL_DCLmatch;
-
-struct LL_DCLmatch
-{
-	off_u64 src_pos, ver_pos;
-	unsigned long len;
-	LL_DCLmatch *next;
-};
-
 typedef struct _CommandBuffer *DCB_ptr;
 typedef command_list overlay_chain;
 
@@ -65,7 +59,7 @@ typedef struct
 	struct _DCB_registered_src *dcb_src;
 	DCB_ptr dcb_ptr;
 	off_u64 ov_offset;
-	off_u32 ov_len;
+	off_u64 ov_len;
 	unsigned char type;
 	DCB_SRC_ID src_id;
 } DCommand;
@@ -76,7 +70,7 @@ typedef struct
 	unsigned int size;
 	unsigned int count;
 	unsigned int pos;
-	off_u32 len;
+	off_u64 len;
 } DCommand_collapsed;
 
 typedef struct
@@ -126,9 +120,9 @@ typedef void (*dcb_truncate_command)(struct _CommandBuffer *, unsigned long);
 typedef void (*dcb_void_cb_command)(struct _CommandBuffer *);
 typedef void (*dcb_void_dcb_command)(void *);
 typedef int (*dcb_int_command)(void *);
-typedef int (*dcb_add_overlay_command)(struct _CommandBuffer *, off_u64, off_u32, DCB_SRC_ID, off_u64, DCB_SRC_ID);
-typedef int (*dcb_add_add_command)(struct _CommandBuffer *, off_u64, off_u32, DCB_SRC_ID);
-typedef int (*dcb_add_copy_command)(struct _CommandBuffer *, off_u64, off_u64, off_u32, DCB_SRC_ID);
+typedef int (*dcb_add_overlay_command)(struct _CommandBuffer *, off_u64, off_u64, DCB_SRC_ID, off_u64, DCB_SRC_ID);
+typedef int (*dcb_add_add_command)(struct _CommandBuffer *, off_u64, off_u64, DCB_SRC_ID);
+typedef int (*dcb_add_copy_command)(struct _CommandBuffer *, off_u64, off_u64, off_u64, DCB_SRC_ID);
 
 typedef struct _DCB_no_buff
 {
@@ -136,6 +130,16 @@ typedef struct _DCB_no_buff
 	cfile *out_cfh;
 } DCB_no_buff;
 
+// handed each command as it's added; nonzero return is an error to pass back.
+typedef int (*dcb_stream_emit_func)(void *, DCommand *);
+
+typedef struct _DCB_stream
+{
+	DCommand dc;
+	dcb_stream_emit_func emit;
+	void *emit_data;
+} DCB_stream;
+
 typedef struct _DCB_full
 {
 	command_list cl;
@@ -150,17 +154,37 @@ typedef struct _DCB_matches
 	u_dcb_src *gap_src;
 } DCB_matches;
 
+typedef struct
+{
+	off_u64 offset, len;
+	// index in main of the match following the gap.
+	unsigned long at;
+} DCB_llm_gap;
+
 typedef struct _DCB_llm
 {
-	off_u64 ver_start, gap_pos;
-	LL_DCLmatch *main_head, *main;
-	unsigned int buff_count, buff_size, main_count;
-	LL_DCLmatch *buff, *cur;
-	void **free;
-	unsigned long free_size, free_count;
+	off_u64 ver_start, ver_end;
+	/* matches, sorted by ver_pos.  Segments finalized into the gap last handed out are queued in
+	   ins, w/ the main index each goes before in ins_at, and merged in on reset. */
+	DCLoc_match *main;
+	unsigned long main_count, main_size, main_pos;
+	DCLoc_match *ins;
+	unsigned long *ins_at;
+	unsigned long ins_count, ins_size;
+	// the segment being built, reused across finalizes.
+	unsigned int buff_count, buff_size;
+	DCLoc_match *buff, *cur;
+	/* every gap between main's matches, in version order.  A finalize landing in the gap last
+	   handed out replaces it in gap_next- gaps before it up to gap_copied are carried over then,
+	   the rest on reset, which swaps the two. */
+	DCB_llm_gap *gaps, *gap_next;
+	unsigned long gap_count, gap_next_count, gap_size, gap_cur, gap_last, gap_copied;
 	unsigned char flags;
 } DCB_llm;
 
+// matches held, whether or not they've been merged into main yet.
+#define DCB_LLM_MATCH_COUNT(dcb) ((dcb)->main_count + (dcb)->ins_count)
+
 typedef struct _CommandBuffer
 {
 	off_u64 src_size;
@@ -246,6 +270,7 @@ int DCB_full_init(CommandBuffer *, unsigned long, off_u64, off_u64);
 int DCB_matches_init(CommandBuffer *, unsigned long, off_u64, off_u64);
 int DCB_llm_init(CommandBuffer *, unsigned long, off_u64, off_u64);
 int DCB_no_buff_init(CommandBuffer *, unsigned long, off_u64, off_u64, cfile *);
+int DCB_stream_init(CommandBuffer *, off_u64, off_u64, dcb_stream_emit_func, void *);
 
 #define DCBufferReset(buff)      \
 	(buff)->reconstruct_pos = 0; \
@@ -268,7 +293,7 @@ unsigned int DCB_get_next_gap(CommandBuffer *buff, unsigned long gap_req,
 #define DCB_get_next_actual_command(dcb, dc) \
 	DCB_get_next_command((dcb), (dc))
 
-int DCB_add_overlay(CommandBuffer *buffer, off_u64 diff_src_pos, off_u32 len,
+int DCB_add_overlay(CommandBuffer *buffer, off_u64 diff_src_pos, off_u64 len,
 					DCB_SRC_ID add_ov_id, off_u64 copy_src_pos, DCB_SRC_ID ov_src_id);
 
 int DCB_rec_copy_from_DCB_src(CommandBuffer *tdcb, command_list *tcl,
@@ -276,12 +301,12 @@ int DCB_rec_copy_from_DCB_src(CommandBuffer *tdcb, command_list *tcl,
 							  unsigned long com_offset, off_u64 seek, off_u64 len);
 
 #ifdef DEV_VERSION
-int DCB_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u32 len, DCB_SRC_ID src_id);
+int DCB_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u64 len, DCB_SRC_ID src_id);
 #else
 #define DCB_add_copy(buff, sp, vp, l, si) (buff)->add_copy((buff), (sp), (vp), (l), (si))
 #endif
 
-int DCB_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u32 len, DCB_SRC_ID src_id);
+int DCB_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u64 len, DCB_SRC_ID src_id);
 
 off_u64
 process_ovchain(CommandBuffer *dcb, off_u64 ver_pos, command_list *cl,
@@ -25,6 +25,8 @@ typedef signed long long act_off_s64;
 #define MAX_SEED_LEN 65535
 #define MAX_SAMPLE_RATE 32767
 #define MAX_HASH_SIZE 2147483647 //if you have 2gb for a hash size... yeah, feel free to donate hardware/memory to me :)
+#define MAX_THREAD_COUNT 256
+#define MAX_STREAM_MB 1048576
 
 #define MEM_ERROR (-3)
 #define FORMAT_ERROR (-4)
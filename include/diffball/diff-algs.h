@@ -8,15 +8,42 @@
 #define COMPUTE_SAMPLE_RATE(hs, data, seed) \
 	((data) > (hs) ? MAX(MAX(seed / 16, 2), ((data) / (hs)) - .5) : MAX(seed / 16, 2))
 #define MULTIPASS_GAP_KLUDGE (1.25)
+// smallest version range worth handing to a thread
+#define MIN_PARALLEL_RANGE_LEN (1 << 20)
+// inputs smaller than this skip MultiPassAlg's chunking pass; the seed passes are cheap enough.
+#define MIN_CDC_PASS_LEN (1UL << 20)
+// streaming default, in bytes.  Half of it goes to the reference window unless told otherwise.
+#define DEFAULT_STREAM_MEMORY (128UL << 20)
+// pessimistic cost of a hash entry; flat hashes round up to a power of 2.
+#define STREAM_HASH_ENTRY_BYTES (16)
+#define MIN_STREAM_SEGMENT_LEN (1UL << 16)
+// shortest match the suffix matcher will emit a copy for; shorter ones rarely pay for splitting an add.
+#define SUFFIX_MIN_MATCH_LEN (20)
+// inputs whose SUFFIX_ALG_MEMORY fits under this are suffix matched; bigger ones go to MultiPass.
+#define DEFAULT_SUFFIX_MEMORY (256UL << 20)
+#define SUFFIX_ALG_MEMORY(ref_len, ver_len) \
+	((off_u64)(ref_len) + (off_u64)(ver_len) + SUFFIX_ARRAY_MEMORY(ref_len))
 
 #include <cfile.h>
 #include <diffball/dcbuffer.h>
 #include <diffball/hash.h>
+#include <diffball/suffix.h>
 
 void print_RefHash_stats(RefHash *rhash);
 signed int OneHalfPassCorrecting(CommandBuffer *buffer, RefHash *rhash, unsigned char src_id,
 								 cfile *ver_cfh, unsigned char ver_id);
+signed int ParallelOneHalfPassCorrecting(CommandBuffer *buffer, RefHash *rhash, unsigned char src_id,
+										 cfile *ver_cfh, unsigned char ver_id, unsigned int thread_count);
+signed int build_reference_hash(RefHash *rhash, cfile *ref_cfh, unsigned long max_hash_size,
+								unsigned long sample_rate, unsigned int seed_len,
+								unsigned long data_len, unsigned int thread_count, RefHashIndex *index);
 signed int MultiPassAlg(CommandBuffer *buffer, cfile *ref_cfh, unsigned char ref_id,
 						cfile *ver_cfh, unsigned char ver_id,
-						unsigned long max_hash_size, unsigned int seed_len);
+						unsigned long max_hash_size, unsigned long first_sample_rate, unsigned int seed_len,
+						unsigned int thread_count, RefHash *ref_hash);
+signed int StreamingAlg(CommandBuffer *buffer, cfile *ref_cfh, unsigned char ref_id,
+						cfile *ver_cfh, unsigned char ver_id,
+						unsigned long window_len, unsigned long mem_budget, unsigned int seed_len);
+signed int SuffixAlg(CommandBuffer *buffer, cfile *ref_cfh, unsigned char ref_id,
+					 cfile *ver_cfh, unsigned char ver_id, unsigned int min_match);
 #endif
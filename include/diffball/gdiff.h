@@ -7,6 +7,8 @@
 #define GDIFF_VER4_MAGIC 4
 #define GDIFF_VER5_MAGIC 5
 #define GDIFF_VER_LEN 1
+// add and copy lengths are at most an int.
+#define GDIFF_MAX_LEN (0xffffffffULL)
 #include <diffball/diff-algs.h>
 #include <diffball/dcbuffer.h>
 #include <cfile.h>
@@ -34,11 +36,22 @@
 	version is one byte.
 	*/
 
+// state for writing a patch a command at a time.
+typedef struct
+{
+	cfile *out_cfh;
+	off_u64 dc_pos;
+	unsigned char off_is_sbytes;
+} gdiff_stream;
+
 unsigned int check_gdiff4_magic(cfile *patchf);
 unsigned int check_gdiff5_magic(cfile *patchf);
 
 signed int gdiffEncodeDCBuffer(CommandBuffer *buffer,
 							   unsigned int offset_type, cfile *out_cfh);
+signed int gdiffStreamStart(gdiff_stream *gs, unsigned int offset_type, cfile *out_cfh);
+signed int gdiffStreamCommand(void *gs, DCommand *dc);
+signed int gdiffStreamFinish(gdiff_stream *gs);
 #define gdiff4EncodeDCBuffer(buff, ocfh) \
 	gdiffEncodeDCBuffer((buff), ENCODING_OFFSET_START, (ocfh))
 #define gdiff5EncodeDCBuffer(buff, ocfh) \
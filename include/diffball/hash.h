@@ -8,11 +8,28 @@
 
 #define DEFAULT_MAX_HASH_COUNT (192000000 / sizeof(unsigned long))
 #define RHASH_INDEX_MASK (0xffff)
+/* buckets are picked by the low 16 bits of the chksum and entries within them told apart by the
+   32 bits above those; anything matching on all 48 is verified against the reference. */
+#define RH_BUCKET_TAG(chksum) ((rh_bucket_tag)((chksum) >> 16))
 #define DEFAULT_RHASH_SIZE (0x10000)
 #define MIN_RHASH_SIZE (0x10000)
 #define DEFAULT_RHASH_BUCKET_SIZE (0x400)
+// smallest chunk of reference worth handing to a hashing thread
+#define MIN_PARALLEL_HASH_RANGE_LEN (1 << 22)
+// how many positions ahead batched lookups prefetch
+#define RH_PREFETCH_DISTANCE (8)
+// prefilter sizing; hashes expected to hold fewer entries than RH_FILTER_MIN_ENTRIES don't get one.
+#define RH_FILTER_BITS_PER_ENTRY (8)
+#define RH_FILTER_PROBES (4)
+#define RH_FILTER_BLOCK_WORDS (8)
+#define RH_FILTER_MIN_ENTRIES (1 << 20)
+#define RH_SORT_HASH (0x04)
+#define RH_RSORT_HASH (0x08)
+// reserved; no modulo based reverse hash is implemented.
+#define RH_RMOD_HASH (0x10)
 #define RH_BUCKET_HASH (0x20)
 #define RH_RBUCKET_HASH (0x40)
+#define RH_FLAT_HASH (0x80)
 
 #define RH_BUCKET_MIN_ALLOC (16)
 #define RH_BUCKET_REALLOC_RATE (2)
@@ -27,6 +44,16 @@
 #define RH_SORTED (0x2)
 #define RH_IS_REVLOOKUP (0x4)
 
+/* how inserts are sampled when sample_rate > 1.  STRIDE inserts every sample_rate'th offset
+   (stepping a byte past duplicates); WINNOW inserts, of every 2 * sample_rate - 1 consecutive
+   offsets, the one whose chksum mixes smallest, so anchors follow content rather than alignment. */
+#define RH_SAMPLE_STRIDE (0)
+#define RH_SAMPLE_WINNOW (1)
+#define RH_WINNOW_WINDOW(sample_rate) (2 * (sample_rate)-1)
+#define DEFAULT_RHASH_SAMPLING (RH_SAMPLE_WINNOW)
+// bytes read per block while winnowing.
+#define RH_WINNOW_READ_LEN (1 << 16)
+
 typedef struct
 {
 	unsigned long chksum;
@@ -40,14 +67,125 @@ struct ll_chksum_ent
 	ll_chksum_ent *next;
 };
 
+typedef unsigned int rh_bucket_tag;
+
 typedef struct
 {
 	unsigned char *depth;
-	unsigned short **chksum;
+	rh_bucket_tag **chksum;
 	off_u64 **offset;
 	unsigned short max_depth;
 } bucket;
 
+/* flat open addressing table; each entry packs a used bit, a chksum tag, and the offset.
+   an entry of 0 is an empty slot. */
+#define RH_FLAT_OFFSET_BITS (40)
+#define RH_FLAT_TAG_BITS (23)
+#define RH_FLAT_MAX_OFFSET ((1ULL << RH_FLAT_OFFSET_BITS) - 1)
+#define RH_FLAT_USED (1ULL << 63)
+// entries past this fraction of the table are refused; keeps probe chains short.
+#define RH_FLAT_MAX_LOAD(slots) ((slots) - ((slots) >> 2))
+#define RH_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// initial chksum log length for a range of a parallel flat build.
+#define RH_FLAT_RANGE_LOG_SIZE (4096)
+
+typedef struct
+{
+	unsigned long long *table;
+	unsigned long mask;
+	unsigned int bits;
+	unsigned long fill;
+	unsigned long max_fill;
+	size_t alloc_len;
+	unsigned char mmapped;
+} flat_hash;
+
+/* frozen, read only form of a bucket hash; entries sorted by the low 32 bits of the chksum, with a
+   directory indexed by the top dir_bits of that key pointing at each run.  Keys and offsets are
+   kept in parallel arrays; no padding, and the key search only touches keys. */
+#define RH_SORT_DIR_RUN (4)
+
+typedef struct
+{
+	unsigned int *dir;
+	unsigned int *keys;
+	off_u64 *offsets;
+	unsigned long count;
+	unsigned int dir_bits;
+	// nonzero if dir and ents are mappings of an index file.
+	unsigned char mmapped;
+} sorted_hash;
+
+/* on disk RefHash index; native layout, meant as a cache alongside a reference, not for
+   interchange.  A file header identifying the reference is followed by records, each a frozen or
+   flat hash over some range of the reference, with its arrays stored raw so they can be mmap'd
+   in place. */
+#define RH_INDEX_MAGIC "DBRHIDX"
+#define RH_INDEX_VERSION (4)
+#define RH_INDEX_ALIGN (8ULL)
+// most arrays a record carries; a sorted hash has its directory, keys and offsets.
+#define RH_INDEX_ARRAYS (3)
+
+typedef struct
+{
+	char magic[8];
+	unsigned int version;
+	unsigned int ent_size;
+	unsigned long long ref_len;
+	unsigned long long ref_fingerprint;
+} rh_index_file_header;
+
+/* a record is keyed by the range and everything the hash was built with: seed_len, sample_rate,
+   sampling, and the type and hr_size it was initialized with (type and hr_size are what it's
+   stored as). */
+typedef struct
+{
+	unsigned int type;
+	unsigned int init_type;
+	unsigned int seed_len;
+	unsigned int sample_rate;
+	unsigned int param;
+	unsigned int sampling;
+	unsigned long long ref_start;
+	unsigned long long ref_end;
+	unsigned long long init_hr_size;
+	unsigned long long hr_size;
+	unsigned long long inserts;
+	unsigned long long duplicates;
+	unsigned long long count;
+	unsigned long long data_offset[RH_INDEX_ARRAYS];
+	unsigned long long data_len[RH_INDEX_ARRAYS];
+} rh_index_record;
+
+typedef struct
+{
+	int fd;
+	int tmp_fd;
+	char *path;
+	char *tmp_path;
+	unsigned long long valid_len;
+	unsigned long long tmp_len;
+	rh_index_file_header header;
+	rh_index_record *records;
+	unsigned long record_count;
+} RefHashIndex;
+
+/* blocked bloom filter consulted ahead of the hash; a key's RH_FILTER_PROBES bits all land in one
+   cacheline sized block, so a miss costs a single cache access.  Keys are the low 32 bits of the
+   chksum, the part every hash type distinguishes entries by. */
+typedef struct
+{
+	unsigned long long *bits;
+	unsigned long blocks;
+	unsigned int shift;
+} rh_filter;
+
+#define RH_FILTER_KEY(chksum) ((unsigned long long)((chksum) & 0xffffffffUL))
+#define RH_FILTER_BLOCK(filter, chksum) \
+	((filter)->bits + ((RH_FILTER_KEY(chksum) * 0x9e3779b97f4a7c15ULL) >> (filter)->shift) * RH_FILTER_BLOCK_WORDS)
+// each probe takes 9 bits off the top; 3 pick the word, 6 the bit.
+#define RH_FILTER_BIT_HASH(chksum) (RH_FILTER_KEY(chksum) * 0xc2b2ae3d27d4eb4fULL)
+
 typedef struct _RefHash *RefHash_ptr;
 
 typedef signed int (*hash_insert_func)(RefHash_ptr, ADLER32_SEED_CTX *, off_u64);
@@ -56,6 +194,7 @@ typedef signed int (*cleanse_hash_func)(RefHash_ptr);
 typedef cleanse_hash_func sort_hash_func;
 typedef void (*reverse_lookups_hash_func)(RefHash_ptr, cfile *);
 typedef off_u64 (*hash_lookup_offset_func)(RefHash_ptr, ADLER32_SEED_CTX *);
+typedef void (*hash_prefetch_func)(RefHash_ptr, unsigned long);
 
 typedef struct _RefHash
 {
@@ -68,11 +207,20 @@ typedef struct _RefHash
 	free_hash_func free_hash;
 	cleanse_hash_func cleanse_hash;
 	hash_lookup_offset_func lookup_offset;
+	// optional; pulls in the memory a lookup of the given chksum will touch.
+	hash_prefetch_func prefetch;
+	// optional prefilter; NULL if lookups go straight to the hash.
+	rh_filter *filter;
 	void *hash;
 	unsigned int sample_rate;
+	// RH_SAMPLE_*; only hash_insert walks honor it, match walks check every offset.
+	unsigned char sampling;
 	cfile *ref_cfh;
 	unsigned long inserts;
 	unsigned long duplicates;
+	// match loop lookups that verified against the reference, and those that were chksum collisions.
+	unsigned long good_matches;
+	unsigned long bad_matches;
 } RefHash;
 
 #define FIND_NEAREST_PRIME_HR(hr_size) \
@@ -87,12 +235,28 @@ init_RefHash(RefHash *rhash, cfile *ref_cfh,
 signed int
 RHash_insert_block(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end);
 
+signed int
+RHash_insert_block_parallel(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end,
+							unsigned int thread_count);
+
 signed int
 RHash_find_matches(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end);
 
 signed int RHash_cleanse(RefHash *rhash);
+signed int RHash_init_filter(RefHash *rhash, unsigned long entries);
+signed int RHash_freeze(RefHash *rhash);
+
+signed int RHash_ref_fingerprint(cfile *ref_cfh, unsigned long long *fingerprint);
+signed int RHash_index_open(RefHashIndex *idx, cfile *ref_cfh, const char *path);
+signed int RHash_index_load(RefHashIndex *idx, RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end,
+							unsigned int seed_len, unsigned int sample_rate, unsigned int sampling, unsigned int type,
+							unsigned long hr_size);
+signed int RHash_index_store(RefHashIndex *idx, RefHash *rhash, off_u64 ref_start, off_u64 ref_end,
+							 unsigned int type, unsigned long hr_size);
+signed int RHash_index_close(RefHashIndex *idx);
 signed int free_RefHash(RefHash *rhash);
 void print_RefHash_stats(RefHash *rhash);
+void print_RefHash_match_stats(RefHash *rhash);
 
 signed int
 RH_bucket_resize(bucket *hash, unsigned long index, unsigned short size);
@@ -107,6 +271,45 @@ rh_rbucket_hash_init(RefHash *rhash, cfile *ref_cfh, unsigned int seed_len, unsi
 signed int
 rh_bucket_hash_init(RefHash *rhash, cfile *ref_cfh, unsigned int seed_len, unsigned int sample_rate, unsigned long hr_size);
 
-#define lookup_offset(rh, ads) (rh)->lookup_offset((rh), (ads))
+signed int
+rh_flat_hash_init(RefHash *rhash, cfile *ref_cfh, unsigned int seed_len, unsigned int sample_rate, unsigned long hr_size,
+				  unsigned int huge_pages);
+
+#ifdef DIFFBALL_ENABLE_INLINE
+inline unsigned int
+RHash_filter_test(rh_filter *filter, unsigned long chksum)
+{
+	unsigned long long *block, h;
+	unsigned int x;
+	if (filter == NULL)
+		return 1;
+	block = RH_FILTER_BLOCK(filter, chksum);
+	h = RH_FILTER_BIT_HASH(chksum);
+	for (x = 0; x < RH_FILTER_PROBES; x++, h <<= 9)
+	{
+		if (!(block[h >> 61] & (1ULL << ((h >> 55) & 63))))
+			return 0;
+	}
+	return 1;
+}
+#else
+unsigned int RHash_filter_test(rh_filter *filter, unsigned long chksum);
+#endif
+
+#define lookup_offset(rh, ads) \
+	(RHash_filter_test((rh)->filter, get_checksum(ads)) ? (rh)->lookup_offset((rh), (ads)) : 0)
+// with a filter, only its block is worth pulling in; most lookups stop there.
+#define prefetch_lookup(rh, chksum)                                      \
+	do                                                                   \
+	{                                                                    \
+		if ((rh)->filter)                                                \
+		{                                                                \
+			__builtin_prefetch(RH_FILTER_BLOCK((rh)->filter, (chksum))); \
+		}                                                                \
+		else if ((rh)->prefetch)                                         \
+		{                                                                \
+			(rh)->prefetch((rh), (chksum));                              \
+		}                                                                \
+	} while (0)
 
 #endif
@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (C) 2003-2015 Brian Harring <ferringb@gmail.com>
+#ifndef _HEADER_SUFFIX
+#define _HEADER_SUFFIX 1
+
+#include <diffball/defs.h>
+
+/* suffix arrays are built w/ signed 32bit positions; larger inputs go to the hash matcher. */
+#define SUFFIX_MAX_LEN (0x7ffffffeUL)
+/* peak bytes needed to build the suffix array of len bytes, on top of the bytes themselves: the
+   array, the first reduced problem's buckets at worst, and every level's type bits. */
+#define SUFFIX_ARRAY_MEMORY(len) \
+	((off_u64)(len) * sizeof(int) + (off_u64)(len) / 2 * sizeof(int) + (off_u64)(len) / 4 + 1024 * sizeof(int))
+
+signed int suffix_array_build(const unsigned char *buff, int *sa, unsigned long len);
+
+#endif
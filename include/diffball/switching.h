@@ -8,6 +8,14 @@
 #define SWITCHING_MAGIC_LEN 9
 #define SWITCHING_VERSION 0x00
 #define SWITCHING_VERSION_LEN 1
+// most a single command carries; the encoder splits anything longer.
+#define SWITCHING_MAX_ADD_LEN (0x40 + 0x4000 + 0x400000 + 0x3fffffffULL)
+#define SWITCHING_MAX_COPY_LEN (0x10 + 0x1000 + 0x100000 + 0xfffffffULL)
+// furthest one relative copy offset moves; further jumps are made in hops.
+#define SWITCHING_MAX_OFF_DELTA (0x8080 + 0x7fffffffLL)
+#define SWITCHING_MAX_ABS_OFFSET (0x100 + 0x10000 + 0x1000000 + 0xffffffffULL)
+// the add block's length is stored in 4 bytes.
+#define SWITCHING_MAX_TOTAL_ADD_LEN (0xffffffffULL)
 
 unsigned int check_switching_magic(cfile *patchf);
 signed int switchingEncodeDCBuffer(CommandBuffer *buffer,
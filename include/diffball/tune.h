@@ -0,0 +1,46 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (C) 2003-2015 Brian Harring <ferringb@gmail.com>
+#ifndef _HEADER_TUNE
+#define _HEADER_TUNE 1
+
+#include <limits.h>
+#include <diffball/defs.h>
+#include <diffball/dcbuffer.h>
+#include <diffball/hash.h>
+
+#define DIFF_TUNE_SUFFIX (1)
+#define DIFF_TUNE_MULTIPASS (2)
+#define DIFF_TUNE_STREAM (3)
+
+/* cost model, calibrated against peak rss of differ runs.  A hash entry at peak is the entry, its
+   share of the bucket's doubling slack, a filter byte, and the sorted copy reverse passes freeze
+   into. */
+#define TUNE_HASH_ENTRY_BYTES (24)
+// matches are assumed this far apart in the version; each is held twice while a pass merges.
+#define TUNE_MATCH_SPACING (256)
+#define TUNE_MATCH_BYTES (2 * sizeof(DCLoc_match))
+// cfile buffers, thread state and the like.
+#define TUNE_BASE_MEMORY (16UL << 20)
+// the bucket hash can't hold more than this, whatever its size.
+#define TUNE_MAX_HASH_ENTRIES ((RHASH_INDEX_MASK + 1UL) * MIN(DEFAULT_RHASH_BUCKET_SIZE, UCHAR_MAX))
+#define TUNE_MAX_SEED_LEN (16384)
+// share of the detected memory limit a run budgets for; the rest is left to the page cache.
+#define TUNE_MEMORY_SHARE (2)
+// used if no limit can be detected.
+#define DEFAULT_TUNE_MEMORY (1UL << 30)
+
+/* what a differencing run is tuned with.  Fields that are nonzero going into diff_tune are kept,
+   the rest are picked to fit mem_budget. */
+typedef struct
+{
+	unsigned long mem_budget;
+	unsigned long hash_size;
+	unsigned long sample_rate;
+	unsigned long seed_len;
+	unsigned int alg;
+} diff_tuning;
+
+unsigned long diff_memory_limit(void);
+void diff_tune(diff_tuning *tune, off_u64 ref_len, off_u64 ver_len);
+
+#endif
@@ -27,7 +27,7 @@ cseek_no_comp(cfile *cfh, void *data, ssize_t offset, ssize_t data_offset, int o
 
 int crefill_no_comp(cfile *cfh, void *data)
 {
-	size_t x;
+	ssize_t x;
 	if ((cfh->access_flags & CFILE_WRITEABLE) && (cfh->data.write_end != 0))
 	{
 		if (cflush(cfh))
@@ -36,25 +36,29 @@ int crefill_no_comp(cfile *cfh, void *data)
 			return 0L;
 		}
 	}
-	if (ensure_lseek_position(cfh))
-	{
-		return (cfh->err = IO_ERROR);
-	}
 	cfh->data.offset += cfh->data.end;
+	/* positional reads; the shared fd's offset is left alone, so children of the same
+	   parent can refill from different threads without stepping on each other's lseek. */
 	if (cfh->data.window_len != 0)
 	{
-		x = read(cfh->raw_fh, cfh->data.buff, MIN(cfh->data.size, cfh->data.window_len - cfh->data.offset));
+		x = pread(cfh->raw_fh, cfh->data.buff, MIN(cfh->data.size, cfh->data.window_len - cfh->data.offset),
+				  cfh->data.window_offset + cfh->data.offset);
 	}
 	else
 	{
-		x = read(cfh->raw_fh, cfh->data.buff, cfh->data.size);
+		x = pread(cfh->raw_fh, cfh->data.buff, cfh->data.size, cfh->data.window_offset + cfh->data.offset);
+	}
+	if (x < 0)
+	{
+		cfh->data.pos = cfh->data.end = 0;
+		return (cfh->err = IO_ERROR);
 	}
 	// is this valid for write & read mode?
 	if (x == 0)
 		cfh->state_flags |= CFILE_EOF;
 	cfh->data.end = x;
 	cfh->data.pos = 0;
-	cfile_lprintf(1, "crefill: %u: no_compress, got %lu\n", cfh->cfh_id, x);
+	cfile_lprintf(1, "crefill: %u: no_compress, got %zi\n", cfh->cfh_id, x);
 	return 0;
 }
 
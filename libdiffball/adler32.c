@@ -13,6 +13,10 @@
 #include <string.h>
 #include <diffball/adler32.h>
 #include <diffball/defs.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define ADLER32_HAVE_AVX2 1
+#endif
 
 int init_adler32_seed(ADLER32_SEED_CTX *ads, unsigned int seed_len)
 {
@@ -45,3 +49,122 @@ free_adler32_seed(ADLER32_SEED_CTX *ads)
 // C standards for inline are stupid.
 extern void update_adler32_seed(ADLER32_SEED_CTX *ads, unsigned char *buff,
                                 unsigned int len);
+
+/* Both kernels compute exactly what update_adler32_seed would (all of it mod 2^word); per byte,
+     s1' = s1 - out + in
+     s2' = (s2 - last_multi * out) * multi + s1'
+   without the ring buffer bookkeeping. */
+static void
+adler32_roll_block_scalar(ADLER32_SEED_CTX *ads, const unsigned char *buff, unsigned long len,
+                          unsigned long *chksums)
+{
+  const unsigned char *out = buff - ads->seed_len;
+  unsigned long s1 = ads->s1, s2 = ads->s2, x;
+  for (x = 0; x < len; x++)
+  {
+    s1 = s1 - out[x] + buff[x];
+    s2 = (s2 - ads->last_multi * out[x]) * ads->multi + s1;
+    chksums[x] = s2;
+  }
+  ads->s1 = s1;
+  ads->s2 = s2;
+}
+
+#ifdef ADLER32_HAVE_AVX2
+/* 64bit lanes times a value that fits in 32 bits; avx2 has no 64bit mullo. */
+__attribute__((target("avx2"))) static inline __m256i
+mul64x32_avx2(__m256i a, __m256i b)
+{
+  return _mm256_add_epi64(_mm256_mul_epu32(a, b),
+                          _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), 32));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+load4_bytes_avx2(const unsigned char *p)
+{
+  int v;
+  memcpy(&v, p, sizeof(int));
+  return _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(v));
+}
+
+/* four positions per step.  With c_k = s1_k - multi * last_multi * out_k the s2 update is
+   s2_k = multi * s2_k-1 + c_k; that's a linear recurrence, so the four lanes are resolved w/ a
+   two step shifted scan (multi, multi^2), plus multi^1..4 * the carried in s2.  For multi < 256,
+   multi^4 fits in 32 bits, so every multiplier used is mul64x32 safe. */
+__attribute__((target("avx2"))) static void
+adler32_roll_block_avx2(ADLER32_SEED_CTX *ads, const unsigned char *buff, unsigned long len,
+                        unsigned long *chksums)
+{
+  const unsigned char *out = buff - ads->seed_len;
+  unsigned long multi = ads->multi;
+  unsigned long m2 = multi * multi, m4 = m2 * m2;
+  unsigned long ml = multi * ads->last_multi;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i v_m1 = _mm256_set1_epi64x(multi);
+  const __m256i v_m2 = _mm256_set1_epi64x(m2);
+  const __m256i v_mpow = _mm256_set_epi64x(m4, m2 * multi, m2, multi);
+  const __m256i v_ml = _mm256_set1_epi64x(ml);
+  __m256i s1 = _mm256_set1_epi64x(ads->s1);
+  __m256i s2 = _mm256_set1_epi64x(ads->s2);
+  __m256i in_v, out_v, d, c, t;
+  unsigned long x = 0;
+
+  for (; x + 4 <= len; x += 4)
+  {
+    in_v = load4_bytes_avx2(buff + x);
+    out_v = load4_bytes_avx2(out + x);
+    // prefix sum of (in - out), added to the carried s1
+    d = _mm256_sub_epi64(in_v, out_v);
+    d = _mm256_add_epi64(d, _mm256_blend_epi32(_mm256_permute4x64_epi64(d, 0x90), zero, 0x03));
+    d = _mm256_add_epi64(d, _mm256_blend_epi32(_mm256_permute4x64_epi64(d, 0x40), zero, 0x0f));
+    s1 = _mm256_add_epi64(s1, d);
+
+    // ml * out; ml is a full word, out is a byte.
+    t = _mm256_add_epi64(_mm256_mul_epu32(v_ml, out_v),
+                         _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(v_ml, 32), out_v), 32));
+    c = _mm256_sub_epi64(s1, t);
+    c = _mm256_add_epi64(c, mul64x32_avx2(_mm256_blend_epi32(_mm256_permute4x64_epi64(c, 0x90), zero, 0x03), v_m1));
+    c = _mm256_add_epi64(c, mul64x32_avx2(_mm256_blend_epi32(_mm256_permute4x64_epi64(c, 0x40), zero, 0x0f), v_m2));
+    s2 = _mm256_add_epi64(c, mul64x32_avx2(s2, v_mpow));
+    _mm256_storeu_si256((__m256i *)(chksums + x), s2);
+
+    // carry lane 3 into the next step
+    s1 = _mm256_permute4x64_epi64(s1, 0xff);
+    s2 = _mm256_permute4x64_epi64(s2, 0xff);
+  }
+  ads->s1 = (unsigned long)_mm256_extract_epi64(s1, 0);
+  ads->s2 = (unsigned long)_mm256_extract_epi64(s2, 0);
+  if (x < len)
+    adler32_roll_block_scalar(ads, buff + x, len - x, chksums + x);
+}
+#endif
+
+void adler32_roll_block(ADLER32_SEED_CTX *ads, const unsigned char *buff, unsigned long len,
+                        unsigned long *chksums)
+{
+  if (len == 0)
+    return;
+#ifdef ADLER32_HAVE_AVX2
+  if (len >= 8 && ads->multi < 256 && __builtin_cpu_supports("avx2"))
+    adler32_roll_block_avx2(ads, buff, len, chksums);
+  else
+#endif
+    adler32_roll_block_scalar(ads, buff, len, chksums);
+
+  // resync the ring to what update_adler32_seed would've left.
+  if (len >= ads->seed_len)
+  {
+    memcpy(ads->seed_chars, buff + len - ads->seed_len, ads->seed_len);
+    ads->tail = 0;
+  }
+  else
+  {
+    unsigned long x;
+    for (x = 0; x < len; x++)
+    {
+      ads->seed_chars[ads->tail] = buff[x];
+      if (++ads->tail == ads->seed_len)
+        ads->tail = 0;
+    }
+  }
+}
@@ -1,75 +1,303 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // Copyright (C) 2003-2015 Brian Harring <ferringb@gmail.com>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <cfile.h>
 #include <diffball/diff-algs.h>
+#include <diffball/tune.h>
 #include <diffball/formats.h>
 #include <diffball/defs.h>
 #include <diffball/apply-patch.h>
+#include <diffball/api.h>
 #include <diffball/errors.h>
 
-int simple_difference(cfile *ref_cfh, cfile *ver_cfh, cfile *out_cfh, unsigned int patch_id, unsigned long seed_len,
-					  unsigned long sample_rate, unsigned long hash_size)
+static int
+encode_patch(CommandBuffer *buffer, cfile *out_cfh, unsigned int patch_id)
+{
+	if (GDIFF4_FORMAT == patch_id)
+	{
+		return gdiff4EncodeDCBuffer(buffer, out_cfh);
+	}
+	else if (GDIFF5_FORMAT == patch_id)
+	{
+		return gdiff5EncodeDCBuffer(buffer, out_cfh);
+	}
+	else if (BDIFF_FORMAT == patch_id)
+	{
+		return bdiffEncodeDCBuffer(buffer, out_cfh);
+	}
+	else if (SWITCHING_FORMAT == patch_id)
+	{
+		return switchingEncodeDCBuffer(buffer, out_cfh);
+	}
+	else if (BDELTA_FORMAT == patch_id)
+	{
+		return bdeltaEncodeDCBuffer(buffer, out_cfh);
+	}
+	else if (TREE_FORMAT == patch_id)
+	{
+		return treeEncodeDCBuffer(buffer, out_cfh);
+	}
+	return UNSUPPORTED_OPT;
+}
+
+static int
+internal_difference(cfile *ref_cfh, cfile *ver_cfh, cfile *out_cfh, unsigned int patch_id, diff_tuning *tune,
+					unsigned int thread_count, RefHash *ref_hash)
 {
 	CommandBuffer buffer;
 	int encode_result;
 	EDCB_SRC_ID ref_id, ver_id;
-	if (hash_size == 0)
+	DCB_llm_init(&buffer, 4, cfile_len(ref_cfh), cfile_len(ver_cfh));
+	ref_id = DCB_REGISTER_ADD_SRC(&buffer, ver_cfh, NULL, 0);
+	ver_id = DCB_REGISTER_COPY_SRC(&buffer, ref_cfh, NULL, 0);
+	/* the suffix matcher finds every match the hash would and more, but holds everything in
+	   memory; if it wasn't tuned for, or fails, MultiPass fills in around whatever it got to. */
+	if (ref_hash != NULL || tune->alg != DIFF_TUNE_SUFFIX ||
+		SuffixAlg(&buffer, ref_cfh, ref_id, ver_cfh, ver_id, SUFFIX_MIN_MATCH_LEN) != 0)
 	{
-		/* implement a better assessment based on mem and such */
-		hash_size = MIN(DEFAULT_MAX_HASH_COUNT, cfile_len(ref_cfh));
+		MultiPassAlg(&buffer, ref_cfh, ref_id, ver_cfh, ver_id, tune->hash_size, tune->sample_rate, tune->seed_len,
+					 thread_count, ref_hash);
 	}
-	if (sample_rate == 0)
+	if ((encode_result = DCB_finalize(&buffer)) == 0)
 	{
-		/* implement a better assessment based on mem and such */
-		sample_rate = COMPUTE_SAMPLE_RATE(hash_size, cfile_len(ref_cfh), seed_len);
+		DCB_test_total_copy_len(&buffer);
+		encode_result = encode_patch(&buffer, out_cfh, patch_id);
 	}
-	if (seed_len == 0)
+	DCBufferFree(&buffer);
+	return encode_result;
+}
+
+static void
+fill_difference_defaults(unsigned int *patch_id, unsigned int *thread_count)
+{
+	if (*patch_id == 0)
 	{
-		seed_len = DEFAULT_MULTIPASS_SEED_LEN;
+		*patch_id = DEFAULT_PATCH_ID;
+	}
+	if (*thread_count == 0)
+	{
+		*thread_count = 1;
 	}
+}
 
-	if (patch_id == 0)
+/* build the reference hash MultiPassAlg's first pass will want, going through the index at
+   index_path if one is given. */
+static int
+prepare_reference_hash(RefHash *rhash, cfile *ref_cfh, diff_tuning *tune, unsigned long data_len,
+					   unsigned int thread_count, const char *index_path)
+{
+	RefHashIndex index;
+	int err;
+	if (index_path)
 	{
-		patch_id = DEFAULT_PATCH_ID;
+		if ((err = RHash_index_open(&index, ref_cfh, index_path)) != 0)
+			return err;
 	}
+	err = build_reference_hash(rhash, ref_cfh, tune->hash_size, tune->sample_rate, tune->seed_len, data_len,
+							   thread_count, index_path ? &index : NULL);
+	if (index_path && RHash_index_close(&index))
+	{
+		dcb_lprintf(0, "failed writing index %s\n", index_path);
+	}
+	return err;
+}
 
-	DCB_llm_init(&buffer, 4, cfile_len(ref_cfh), cfile_len(ver_cfh));
-	ref_id = DCB_REGISTER_ADD_SRC(&buffer, ver_cfh, NULL, 0);
-	ver_id = DCB_REGISTER_COPY_SRC(&buffer, ref_cfh, NULL, 0);
-	MultiPassAlg(&buffer, ref_cfh, ref_id, ver_cfh, ver_id, hash_size, seed_len);
-	if ((encode_result = DCB_finalize(&buffer)) != 0)
+int simple_difference(cfile *ref_cfh, cfile *ver_cfh, cfile *out_cfh, unsigned int patch_id, unsigned long seed_len,
+					  unsigned long sample_rate, unsigned long hash_size, unsigned int thread_count,
+					  const char *index_path, unsigned long mem_budget)
+{
+	RefHash rhash;
+	diff_tuning tune;
+	int encode_result;
+	fill_difference_defaults(&patch_id, &thread_count);
+	tune.mem_budget = mem_budget;
+	tune.seed_len = seed_len;
+	tune.sample_rate = sample_rate;
+	tune.hash_size = hash_size;
+	diff_tune(&tune, cfile_len(ref_cfh), cfile_len(ver_cfh));
+	if (tune.alg == DIFF_TUNE_STREAM)
+	{
+		if (index_path == NULL && (GDIFF4_FORMAT == patch_id || GDIFF5_FORMAT == patch_id))
+		{
+			return simple_difference_stream(ref_cfh, ver_cfh, out_cfh, patch_id, seed_len, 0, tune.mem_budget);
+		}
+		dcb_lprintf(1, "only gdiff w/out an index can stream; trying the smallest hash instead\n");
+	}
+
+	if (index_path == NULL)
+	{
+		return internal_difference(ref_cfh, ver_cfh, out_cfh, patch_id, &tune, thread_count, NULL);
+	}
+	if ((encode_result = prepare_reference_hash(&rhash, ref_cfh, &tune, cfile_len(ver_cfh), thread_count,
+												index_path)) != 0)
+	{
 		return encode_result;
-	DCB_test_total_copy_len(&buffer);
-	if (GDIFF4_FORMAT == patch_id)
+	}
+	encode_result = internal_difference(ref_cfh, ver_cfh, out_cfh, patch_id, &tune, thread_count, &rhash);
+	free_RefHash(&rhash);
+	return encode_result;
+}
+
+int simple_difference_stream(cfile *ref_cfh, cfile *ver_cfh, cfile *out_cfh, unsigned int patch_id,
+							 unsigned long seed_len, unsigned long window_len, unsigned long mem_budget)
+{
+	CommandBuffer buffer;
+	gdiff_stream gs;
+	EDCB_SRC_ID ref_id, ver_id;
+	unsigned int offset_type;
+	int err;
+	// commands are written as they're found, so only formats w/ inline adds and no up front counts work.
+	if (patch_id == 0 || GDIFF5_FORMAT == patch_id)
 	{
-		encode_result = gdiff4EncodeDCBuffer(&buffer, out_cfh);
+		offset_type = ENCODING_OFFSET_DC_POS;
 	}
-	else if (GDIFF5_FORMAT == patch_id)
+	else if (GDIFF4_FORMAT == patch_id)
 	{
-		encode_result = gdiff5EncodeDCBuffer(&buffer, out_cfh);
+		offset_type = ENCODING_OFFSET_START;
 	}
-	else if (BDIFF_FORMAT == patch_id)
+	else
 	{
-		encode_result = bdiffEncodeDCBuffer(&buffer, out_cfh);
+		dcb_lprintf(0, "streaming differencing only supports the gdiff formats\n");
+		return UNSUPPORTED_OPT;
 	}
-	else if (SWITCHING_FORMAT == patch_id)
+	if (seed_len == 0)
 	{
-		encode_result = switchingEncodeDCBuffer(&buffer, out_cfh);
+		seed_len = DEFAULT_MULTIPASS_SEED_LEN;
 	}
-	else if (BDELTA_FORMAT == patch_id)
+	if (mem_budget == 0)
 	{
-		encode_result = bdeltaEncodeDCBuffer(&buffer, out_cfh);
+		mem_budget = DEFAULT_STREAM_MEMORY;
 	}
-	else if (TREE_FORMAT == patch_id)
+	if ((err = DCB_stream_init(&buffer, cfile_len(ref_cfh), cfile_len(ver_cfh), gdiffStreamCommand, &gs)) != 0)
 	{
-		encode_result = treeEncodeDCBuffer(&buffer, out_cfh);
+		return err;
 	}
-	else
+	ver_id = DCB_REGISTER_ADD_SRC(&buffer, ver_cfh, NULL, 0);
+	ref_id = DCB_REGISTER_COPY_SRC(&buffer, ref_cfh, NULL, 0);
+	if (ver_id < 0 || ref_id < 0)
+	{
+		err = MEM_ERROR;
+	}
+	else if ((err = gdiffStreamStart(&gs, offset_type, out_cfh)) == 0 &&
+			 (err = StreamingAlg(&buffer, ref_cfh, ref_id, ver_cfh, ver_id, window_len, mem_budget, seed_len)) == 0)
 	{
-		encode_result = UNSUPPORTED_OPT;
+		err = gdiffStreamFinish(&gs);
 	}
 	DCBufferFree(&buffer);
-	return encode_result;
+	return err;
+}
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	unsigned int next;
+	unsigned int ver_count;
+	cfile *ref_cfh;
+	cfile **ver_cfhs;
+	cfile **out_cfhs;
+	int *results;
+	RefHash *ref_hash;
+	unsigned int patch_id;
+	diff_tuning *tune;
+	unsigned char dup_ref;
+} batch_difference_ctx;
+
+static void *
+batch_difference_worker(void *data)
+{
+	batch_difference_ctx *ctx = (batch_difference_ctx *)data;
+	cfile *ref_cfh = ctx->ref_cfh;
+	RefHash rhash;
+	unsigned int x;
+	// each worker reads the reference through its own handle; the hash itself is shared, read only.
+	if (ctx->dup_ref && (ref_cfh = copen_dup_cfh(ctx->ref_cfh)) == NULL)
+		return NULL;
+	rhash = *ctx->ref_hash;
+	rhash.ref_cfh = ref_cfh;
+	for (;;)
+	{
+		pthread_mutex_lock(&ctx->lock);
+		x = ctx->next++;
+		pthread_mutex_unlock(&ctx->lock);
+		if (x >= ctx->ver_count)
+			break;
+		dcb_lprintf(1, "differencing target %u\n", x);
+		ctx->results[x] = internal_difference(ref_cfh, ctx->ver_cfhs[x], ctx->out_cfhs[x], ctx->patch_id, ctx->tune,
+											  1, &rhash);
+	}
+	if (ctx->dup_ref)
+	{
+		cclose(ref_cfh);
+		free(ref_cfh);
+	}
+	return NULL;
+}
+
+int simple_difference_batch(cfile *ref_cfh, cfile *ver_cfhs[], cfile *out_cfhs[], unsigned int ver_count,
+							unsigned int patch_id, unsigned long seed_len, unsigned long hash_size,
+							unsigned int thread_count, const char *index_path, unsigned long mem_budget,
+							int results[])
+{
+	batch_difference_ctx ctx;
+	RefHash rhash;
+	diff_tuning tune;
+	pthread_t *threads;
+	unsigned int x, started;
+	int err;
+	fill_difference_defaults(&patch_id, &thread_count);
+	for (x = 0; x < ver_count; x++)
+		results[x] = MEM_ERROR;
+	if (ver_count == 0)
+		return 0;
+
+	// the targets vary; size the shared hash and its sampling against the reference itself.
+	tune.mem_budget = mem_budget;
+	tune.seed_len = seed_len;
+	tune.sample_rate = 0;
+	tune.hash_size = hash_size;
+	diff_tune(&tune, cfile_len(ref_cfh), cfile_len(ref_cfh));
+	if ((err = prepare_reference_hash(&rhash, ref_cfh, &tune, cfile_len(ref_cfh), thread_count, index_path)) != 0)
+	{
+		return err;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	pthread_mutex_init(&ctx.lock, NULL);
+	ctx.ver_count = ver_count;
+	ctx.ref_cfh = ref_cfh;
+	ctx.ver_cfhs = ver_cfhs;
+	ctx.out_cfhs = out_cfhs;
+	ctx.results = results;
+	ctx.ref_hash = &rhash;
+	ctx.patch_id = patch_id;
+	ctx.tune = &tune;
+	// sibling handles can only read concurrently from uncompressed, single file references.
+	if (ref_cfh->compressor_type != NO_COMPRESSOR || (ref_cfh->state_flags & CFILE_CHILD_INHERITS_IO))
+		thread_count = 1;
+	thread_count = MIN(thread_count, ver_count);
+	ctx.dup_ref = (thread_count > 1);
+	dcb_lprintf(1, "differencing %u targets across %u workers\n", ver_count, thread_count);
+
+	threads = (pthread_t *)calloc(thread_count, sizeof(pthread_t));
+	for (started = 0; threads && thread_count > 1 && started < thread_count; started++)
+	{
+		if (pthread_create(threads + started, NULL, batch_difference_worker, &ctx))
+			break;
+	}
+	// single worker, or no threads could be started; do it all here.
+	if (started == 0)
+	{
+		ctx.dup_ref = 0;
+		batch_difference_worker(&ctx);
+	}
+	for (x = 0; x < started; x++)
+		pthread_join(threads[x], NULL);
+	free(threads);
+	pthread_mutex_destroy(&ctx.lock);
+	free_RefHash(&rhash);
+	return 0;
 }
 
 int simple_reconstruct(cfile *src_cfh, cfile **patch_cfh, unsigned char patch_count, cfile *out_cfh, unsigned int force_patch_id,
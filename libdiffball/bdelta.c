@@ -28,13 +28,13 @@ check_bdelta_magic(cfile *patchf)
 signed int
 bdeltaEncodeDCBuffer(CommandBuffer *dcbuff, cfile *patchf)
 {
-	off_u32 dc_pos, total_count, count, matches;
-	off_u32 add_len, copy_len;
+	off_u64 dc_pos, total_count, count, matches;
+	off_u64 add_len, copy_len;
 	off_u64 copy_offset;
 	unsigned char prev, current;
 	unsigned int intsize;
-	unsigned char buff[16];
-	off_u32 match_orig;
+	unsigned char buff[24];
+	off_u64 match_orig;
 	unsigned long ver_size = 0;
 	DCommand dc;
 
@@ -58,10 +58,14 @@ bdeltaEncodeDCBuffer(CommandBuffer *dcbuff, cfile *patchf)
 			  (prev == DC_ADD && current == DC_ADD)))
 			matches++;
 	}
-	intsize = 4;
+	// copy offsets are signed; past 2GiB they need the wider ints.
+	if (MAX(dcbuff->src_size, (dcbuff->ver_size ? dcbuff->ver_size : ver_size)) > 0x7fffffff)
+		intsize = 8;
+	else
+		intsize = 4;
 
-	dcb_lprintf(2, "size1=%llu, size2=%llu, matches=%u, intsize=%u\n", (act_off_u64)dcbuff->src_size,
-				(act_off_u64)(dcbuff->ver_size ? dcbuff->ver_size : ver_size), matches, intsize);
+	dcb_lprintf(2, "size1=%llu, size2=%llu, matches=%llu, intsize=%u\n", (act_off_u64)dcbuff->src_size,
+				(act_off_u64)(dcbuff->ver_size ? dcbuff->ver_size : ver_size), (act_off_u64)matches, intsize);
 
 	buff[0] = intsize;
 	cwrite(patchf, buff, 1);
@@ -76,7 +80,7 @@ bdeltaEncodeDCBuffer(CommandBuffer *dcbuff, cfile *patchf)
 	while (matches--)
 	{
 		DCB_get_next_command(dcbuff, &dc);
-		dcb_lprintf(2, "handling match(%u)\n", match_orig - matches);
+		dcb_lprintf(2, "handling match(%llu)\n", (act_off_u64)(match_orig - matches));
 		add_len = 0;
 		if (DC_ADD == dc.type)
 		{
@@ -86,7 +90,7 @@ bdeltaEncodeDCBuffer(CommandBuffer *dcbuff, cfile *patchf)
 				count--;
 				DCB_get_next_command(dcbuff, &dc);
 			} while (count != 0 && DC_ADD == dc.type);
-			dcb_lprintf(2, "writing add len=%u\n", add_len);
+			dcb_lprintf(2, "writing add len=%llu\n", (act_off_u64)add_len);
 		}
 		/* basically a fall through to copy, if count!=0 */
 		if (count != 0)
@@ -94,19 +98,19 @@ bdeltaEncodeDCBuffer(CommandBuffer *dcbuff, cfile *patchf)
 			copy_len = dc.data.len;
 			if (dc_pos > dc.data.src_pos)
 			{
-				dcb_lprintf(2, "negative offset, dc_pos(%u), offset(%llu)\n",
-							dc_pos, (act_off_u64)dc.data.src_pos);
+				dcb_lprintf(2, "negative offset, dc_pos(%llu), offset(%llu)\n",
+							(act_off_u64)dc_pos, (act_off_u64)dc.data.src_pos);
 				copy_offset = dc.data.src_pos + (~dc_pos + 1);
 			}
 			else
 			{
-				dcb_lprintf(2, "positive offset, dc_pos(%u), offset(%llu)\n",
-							dc_pos, (act_off_u64)dc.data.src_pos);
+				dcb_lprintf(2, "positive offset, dc_pos(%llu), offset(%llu)\n",
+							(act_off_u64)dc_pos, (act_off_u64)dc.data.src_pos);
 				copy_offset = dc.data.src_pos - dc_pos;
 			}
 			dc_pos = dc.data.src_pos + dc.data.len;
-			dcb_lprintf(2, "writing copy_len=%u, offset=%llu, dc_pos=%u\n",
-						copy_len, (act_off_u64)dc.data.src_pos, dc_pos);
+			dcb_lprintf(2, "writing copy_len=%llu, offset=%llu, dc_pos=%llu\n",
+						(act_off_u64)copy_len, (act_off_u64)dc.data.src_pos, (act_off_u64)dc_pos);
 		}
 		else
 		{
@@ -121,7 +125,7 @@ bdeltaEncodeDCBuffer(CommandBuffer *dcbuff, cfile *patchf)
 	}
 	/* control block wrote. */
 	DCBufferReset(dcbuff);
-	dcb_lprintf(2, "writing add_block at %u\n", (off_u32)ctell(patchf, CSEEK_FSTART));
+	dcb_lprintf(2, "writing add_block at %llu\n", (act_off_u64)ctell(patchf, CSEEK_FSTART));
 	while (DCB_commands_remain(dcbuff))
 	{
 		DCB_get_next_command(dcbuff, &dc);
@@ -140,16 +144,16 @@ signed int
 bdeltaReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 {
 	unsigned int int_size;
-#define BUFF_SIZE 12
+#define BUFF_SIZE 24
 	unsigned int ver;
 	unsigned char buff[BUFF_SIZE];
 	off_s64 copy_offset;
-	off_u32 match_orig, matches, add_len, copy_len;
-	off_u32 size1, size2, or_mask = 0, neg_mask;
+	off_u64 match_orig, matches, add_len, copy_len;
+	off_u64 size1, size2, or_mask = 0, neg_mask;
 	off_u64 ver_pos = 0, add_pos;
 	off_u64 processed_size = 0;
 	// Used for internal bookkeeping that is then asserted against if in debug mode.
-	off_u32 add_start __attribute__((unused));
+	off_u64 add_start __attribute__((unused));
 
 	dcbuff->ver_size = 0;
 	if (3 != cseek(patchf, BDELTA_MAGIC_LEN, CSEEK_FSTART))
@@ -161,35 +165,27 @@ bdeltaReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 	cread(patchf, buff, 1);
 	int_size = buff[0];
 	dcb_lprintf(2, "int_size=%u\n", int_size);
-	if (int_size < 1 || int_size > 4)
+	if (int_size < 1 || int_size > 8 || int_size > sizeof(off_u64))
 		return PATCH_CORRUPT_ERROR;
-	/* yes, this is an intentional switch fall through. */
-	switch (int_size)
-	{
-	case 1:
-		or_mask |= 0x0000ff00;
-	case 2:
-		or_mask |= 0x00ff0000;
-	case 3:
-		or_mask |= 0xff000000;
-	}
-	/* yes this will have problems w/ int_size==0 */
-	neg_mask = (1 << ((int_size * 8) - 1));
+	// sign extension for negative copy offsets.
+	if (int_size < sizeof(off_u64))
+		or_mask = ~(off_u64)0 << (int_size * 8);
+	neg_mask = (off_u64)1 << ((int_size * 8) - 1);
 	cread(patchf, buff, 3 * int_size);
 	size1 = readUBytesLE(buff, int_size);
 	size2 = readUBytesLE(buff + int_size, int_size);
-	dcb_lprintf(1, "size1=%u, size2=%u\n", size1, size2);
+	dcb_lprintf(1, "size1=%llu, size2=%llu\n", (act_off_u64)size1, (act_off_u64)size2);
 	dcbuff->src_size = size1;
 	dcbuff->ver_size = size2;
 	matches = readUBytesLE(buff + (2 * int_size), int_size);
-	dcb_lprintf(2, "size1=%u, size2=%u\nmatches=%u\n", size1, size2, matches);
+	dcb_lprintf(2, "size1=%llu, size2=%llu\nmatches=%llu\n", (act_off_u64)size1, (act_off_u64)size2, (act_off_u64)matches);
 	/* add_pos = header info, 3 int_size's (size(1|2), num_match) */
 	add_pos = 3 + 2 + 1 + (3 * int_size);
 	/* add block starts after control data. */
 	add_pos += (matches * (3 * int_size));
 	add_start = add_pos;
 	EDCB_SRC_ID add_id = DCB_REGISTER_VOLATILE_ADD_SRC(dcbuff, patchf, NULL, 0);
-	dcb_lprintf(2, "add block starts at %u\nprocessing commands\n", add_pos);
+	dcb_lprintf(2, "add block starts at %llu\nprocessing commands\n", (act_off_u64)add_pos);
 	match_orig = matches;
 	if (size1 == 0)
 	{
@@ -199,14 +195,14 @@ bdeltaReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 	}
 	while (matches--)
 	{
-		dcb_lprintf(2, "handling match(%u)\n", match_orig - matches);
+		dcb_lprintf(2, "handling match(%llu)\n", (act_off_u64)(match_orig - matches));
 		cread(patchf, buff, 3 * int_size);
 		copy_offset = readUBytesLE(buff, int_size);
 		add_len = readUBytesLE(buff + int_size, int_size);
 		copy_len = readUBytesLE(buff + int_size * 2, int_size);
 		if (add_len)
 		{
-			dcb_lprintf(2, "add  len(%u)\n", add_len);
+			dcb_lprintf(2, "add  len(%llu)\n", (act_off_u64)add_len);
 			DCB_add_add(dcbuff, add_pos, add_len, add_id);
 			add_pos += add_len;
 		}
@@ -228,8 +224,8 @@ bdeltaReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 		assert(size1 == 0 || ver_pos <= size1);
 		if (copy_len)
 		{
-			dcb_lprintf(2, "copy len(%u), off(%lld), pos(%llu)\n",
-						copy_len, (act_off_s64)copy_offset, (act_off_u64)ver_pos);
+			dcb_lprintf(2, "copy len(%llu), off(%lld), pos(%llu)\n",
+						(act_off_u64)copy_len, (act_off_s64)copy_offset, (act_off_u64)ver_pos);
 			DCB_add_copy(dcbuff, ver_pos, 0, copy_len, src_id);
 			ver_pos += copy_len;
 		}
@@ -242,8 +238,8 @@ bdeltaReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 		DCB_add_add(dcbuff, add_pos, size2 - processed_size, 0);
 	}
 	dcbuff->ver_size = dcbuff->reconstruct_pos;
-	dcb_lprintf(2, "finished reading.  ver_pos=%llu, add_pos=%u\n",
-				(act_off_u64)ver_pos, add_pos);
+	dcb_lprintf(2, "finished reading.  ver_pos=%llu, add_pos=%llu\n",
+				(act_off_u64)ver_pos, (act_off_u64)add_pos);
 	return 0;
 
 truncated_patch:
@@ -31,8 +31,8 @@ bdiffEncodeDCBuffer(CommandBuffer *buffer, cfile *out_cfh)
 {
 #define BUFFER_SIZE 1024
 	unsigned char buff[BUFFER_SIZE];
-	off_u32 delta_pos;
-	off_u64 fh_pos;
+	off_u64 delta_pos;
+	off_u64 fh_pos, remain;
 	off_u32 lb;
 	DCommand dc;
 
@@ -52,47 +52,57 @@ bdiffEncodeDCBuffer(CommandBuffer *buffer, cfile *out_cfh)
 	while (DCB_commands_remain(buffer))
 	{
 		DCB_get_next_command(buffer, &dc);
-		if (DC_COPY == dc.type)
+		// offsets and lengths are 4 bytes; lengths past that go out in pieces.
+		for (remain = dc.data.len; remain; remain -= dc.data.len, dc.data.src_pos += dc.data.len)
 		{
-			dcb_lprintf(2, "copy command, out_cfh(%u), fh_pos(%llu), offset(%llu), len(%u)\n",
-						delta_pos, (act_off_u64)fh_pos, (act_off_u64)dc.data.src_pos, dc.data.len);
-			fh_pos += dc.data.len;
-			lb = 5;
-			buff[0] = 0;
-			writeUBytesBE(buff + 1, dc.data.src_pos, 4);
-			if (dc.data.len > 5 && dc.data.len <= 5 + 0x3f)
-			{
-				buff[0] = dc.data.len - 5;
-			}
-			else
+			dc.data.len = MIN(remain, BDIFF_MAX_VALUE);
+			if (DC_COPY == dc.type)
 			{
-				writeUBytesBE(buff + 5, dc.data.len, 4);
-				lb += 4;
-			}
-			delta_pos += lb;
-			cwrite(out_cfh, buff, lb);
-		}
-		else
-		{
-			dcb_lprintf(2, "add  command, out_cfh(%u), fh_pos(%llu), len(%u)\n",
-						delta_pos, (act_off_u64)fh_pos, dc.data.len);
-			fh_pos += dc.data.len;
-			buff[0] = 0x80;
-			lb = 1;
-			if (dc.data.len > 5 && dc.data.len <= 5 + 0x3f)
-			{
-				buff[0] |= dc.data.len - 5;
+				if (dc.data.src_pos > BDIFF_MAX_VALUE)
+				{
+					eprintf("copy offset %llu is past what the bdiff format can address\n", (act_off_u64)dc.data.src_pos);
+					return FORMAT_ERROR;
+				}
+				dcb_lprintf(2, "copy command, out_cfh(%llu), fh_pos(%llu), offset(%llu), len(%llu)\n",
+							(act_off_u64)delta_pos, (act_off_u64)fh_pos, (act_off_u64)dc.data.src_pos, (act_off_u64)dc.data.len);
+				fh_pos += dc.data.len;
+				lb = 5;
+				buff[0] = 0;
+				writeUBytesBE(buff + 1, dc.data.src_pos, 4);
+				if (dc.data.len > 5 && dc.data.len <= 5 + 0x3f)
+				{
+					buff[0] = dc.data.len - 5;
+				}
+				else
+				{
+					writeUBytesBE(buff + 5, dc.data.len, 4);
+					lb += 4;
+				}
+				delta_pos += lb;
+				cwrite(out_cfh, buff, lb);
 			}
 			else
 			{
-				writeUBytesBE(buff + 1, dc.data.len, 4);
-				lb += 4;
-			}
-			delta_pos += lb + dc.data.len;
-			cwrite(out_cfh, buff, lb);
-			if (dc.data.len != copyDCB_add_src(buffer, &dc, out_cfh))
-			{
-				return EOF_ERROR;
+				dcb_lprintf(2, "add  command, out_cfh(%llu), fh_pos(%llu), len(%llu)\n",
+							(act_off_u64)delta_pos, (act_off_u64)fh_pos, (act_off_u64)dc.data.len);
+				fh_pos += dc.data.len;
+				buff[0] = 0x80;
+				lb = 1;
+				if (dc.data.len > 5 && dc.data.len <= 5 + 0x3f)
+				{
+					buff[0] |= dc.data.len - 5;
+				}
+				else
+				{
+					writeUBytesBE(buff + 1, dc.data.len, 4);
+					lb += 4;
+				}
+				delta_pos += lb + dc.data.len;
+				cwrite(out_cfh, buff, lb);
+				if (dc.data.len != copyDCB_add_src(buffer, &dc, out_cfh))
+				{
+					return EOF_ERROR;
+				}
 			}
 		}
 	}
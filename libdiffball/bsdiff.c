@@ -53,7 +53,7 @@ bsdiff_overlay_copy(DCommand *dc,
 	ov = dc->dcb_src->ov;
 
 	// error checking...
-	dcb_lprintf(3, "processing src(%llu), len(%u), ver(%llu)\n", (act_off_u64)dc->data.src_pos, dc->data.len, (act_off_u64)dc->data.ver_pos);
+	dcb_lprintf(3, "processing src(%llu), len(%llu), ver(%llu)\n", (act_off_u64)dc->data.src_pos, (act_off_u64)dc->data.len, (act_off_u64)dc->data.ver_pos);
 	cflush(out_cfh);
 	if (dc->data.src_pos != cseek(dc->dcb_src->src_ptr.cfh, dc->data.src_pos, CSEEK_FSTART))
 	{
@@ -124,7 +124,14 @@ check_bsdiff_magic(cfile *patchf)
 	return 2;
 }
 
-/* note this currently only supports u32, no u64. yet */
+/* bsdiff offsets are 8 byte LE magnitudes w/ the sign in the top bit. */
+static off_s64
+bsdiff_read_off(const unsigned char *buff)
+{
+	off_s64 val = (off_s64)(readUBytesLE(buff, 8) & 0x7fffffffffffffffULL);
+	return (buff[7] & 0x80) ? -val : val;
+}
+
 signed int
 bsdiffReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 {
@@ -136,9 +143,9 @@ bsdiffReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 	EDCB_SRC_ID diff_id = -1, extra_id = -1;
 	unsigned char ver;
 	unsigned char buff[32];
-	off_u32 len1, len2, diff_offset, extra_offset;
-	off_s32 seek;
-	off_u32 diff_len, ctrl_len;
+	off_u64 len1, len2, diff_offset, extra_offset;
+	off_s64 seek;
+	off_u64 diff_len, ctrl_len;
 	off_u64 ver_size;
 	off_u64 ver_pos, src_pos;
 
@@ -170,12 +177,12 @@ bsdiffReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 	{
 		return MEM_ERROR;
 	}
-	ctrl_len = readUBytesLE(buff + 8, 4);
-	diff_len = readUBytesLE(buff + 16, 4);
-	ver_size = readUBytesLE(buff + 24, 4);
+	ctrl_len = bsdiff_read_off(buff + 8);
+	diff_len = bsdiff_read_off(buff + 16);
+	ver_size = bsdiff_read_off(buff + 24);
 	dcbuff->ver_size = ver_size;
-	dcb_lprintf(1, "start=32, ctrl_len=%u, diff_len=%u, ver_size=%llu\n",
-				ctrl_len, diff_len, (act_off_u64)ver_size);
+	dcb_lprintf(1, "start=32, ctrl_len=%llu, diff_len=%llu, ver_size=%llu\n",
+				(act_off_u64)ctrl_len, (act_off_u64)diff_len, (act_off_u64)ver_size);
 	if (copen_child_cfh(&ctrl_cfh, patchf, 32, ctrl_len + 32,
 						BZIP2_COMPRESSOR, CFILE_RONLY))
 	{
@@ -207,25 +214,18 @@ bsdiffReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 	len2 = 0;
 	while (cread(&ctrl_cfh, buff, ver) == ver)
 	{
-		len1 = readUBytesLE(buff, 4);
+		len1 = bsdiff_read_off(buff);
 		if (ver > 16)
 		{
-			len2 = readUBytesLE(buff + 8, 4);
-			seek = readUBytesLE(buff + 16, 4);
-			if (buff[23] & 0x80)
-			{
-				seek = -seek;
-			}
-			dcb_lprintf(2, "len1(%u), len2(%u), seek(%u)\n", len1, len2, seek);
+			len2 = bsdiff_read_off(buff + 8);
+			seek = bsdiff_read_off(buff + 16);
+			dcb_lprintf(2, "len1(%llu), len2(%llu), seek(%lld)\n", (act_off_u64)len1,
+						(act_off_u64)len2, (act_off_s64)seek);
 		}
 		else
 		{
-			seek = readUBytesLE(buff + 8, 4);
-			if (buff[15] & 0x80)
-			{
-				seek = -seek;
-			}
-			dcb_lprintf(2, "len1(%u), seek(%d)\n", len1, seek);
+			seek = bsdiff_read_off(buff + 8);
+			dcb_lprintf(2, "len1(%llu), seek(%lld)\n", (act_off_u64)len1, (act_off_s64)seek);
 		}
 		if (len1)
 		{
@@ -245,8 +245,8 @@ bsdiffReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff)
 		assert(ver_pos == dcbuff->reconstruct_pos);
 		assert(ver_pos <= ver_size);
 	}
-	dcb_lprintf(1, "ver_pos=%llu, size=%llu, extra_pos=%u, diff_pos=%u, ctrl_pos=%llu, recon=%llu\n", (act_off_u64)ver_pos, (act_off_u64)ver_size,
-				extra_offset, diff_offset, (act_off_u64)ctrl_cfh.data.pos + ctrl_cfh.data.offset,
+	dcb_lprintf(1, "ver_pos=%llu, size=%llu, extra_pos=%llu, diff_pos=%llu, ctrl_pos=%llu, recon=%llu\n", (act_off_u64)ver_pos, (act_off_u64)ver_size,
+				(act_off_u64)extra_offset, (act_off_u64)diff_offset, (act_off_u64)ctrl_cfh.data.pos + ctrl_cfh.data.offset,
 				(act_off_u64)dcbuff->reconstruct_pos);
 	if (ver_pos != ver_size)
 	{
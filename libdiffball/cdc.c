@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (C) 2003-2015 Brian Harring <ferringb@gmail.com>
+
+/* content defined chunking via a gear hash (Xia et al, "FastCDC: a Fast and Efficient Content
+   Defined Chunking Approach for Data Deduplication").  Boundaries are picked from the data
+   itself, so identical regions of two files chunk identically no matter where they sit. */
+#include <stdlib.h>
+#include <string.h>
+#include <cfile.h>
+#include <diffball/defs.h>
+#include <diffball/cdc.h>
+
+// 15 bits below the average, 11 above; pulls chunk lengths in around CDC_AVG_CHUNK.
+#define CDC_MASK_S (0x0000d9f003530000ULL)
+#define CDC_MASK_L (0x0000d90003530000ULL)
+#define CDC_READ_LEN (1UL << 20)
+#define FNV64_OFFSET (0xcbf29ce484222325ULL)
+#define FNV64_PRIME (0x100000001b3ULL)
+
+// the gear table only has to be fixed and well mixed; splitmix64 from a constant seed is both.
+static void
+cdc_gear_init(unsigned long long *gear)
+{
+	unsigned long long x = 0x9e3779b97f4a7c15ULL, z;
+	int i;
+	for (i = 0; i < 256; i++)
+	{
+		x += 0x9e3779b97f4a7c15ULL;
+		z = x;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+signed int
+cdc_chunk_cfile(cfile *cfh, cdc_chunk **chunks, unsigned long *count)
+{
+	unsigned long long gear[256], h = 0, fp = FNV64_OFFSET;
+	unsigned char *buff;
+	cdc_chunk *list = NULL, *tmp;
+	unsigned long size = 0, len = 0, x;
+	off_u64 start = 0, pos = 0;
+	ssize_t read_len;
+
+	*chunks = NULL;
+	*count = 0;
+	if ((buff = (unsigned char *)malloc(CDC_READ_LEN)) == NULL)
+		return MEM_ERROR;
+	cdc_gear_init(gear);
+	if (0 != cseek(cfh, 0, CSEEK_FSTART))
+	{
+		free(buff);
+		return IO_ERROR;
+	}
+	while ((read_len = cread(cfh, buff, CDC_READ_LEN)) > 0)
+	{
+		for (x = 0; x < (unsigned long)read_len; x++)
+		{
+			h = (h << 1) + gear[buff[x]];
+			fp = (fp ^ buff[x]) * FNV64_PRIME;
+			len++;
+			if (len < CDC_MIN_CHUNK)
+				continue;
+			if (len < CDC_MAX_CHUNK && (h & (len < CDC_AVG_CHUNK ? CDC_MASK_S : CDC_MASK_L)))
+				continue;
+			if (*count == size)
+			{
+				size = (size ? size * 2 : 1024);
+				if ((tmp = (cdc_chunk *)realloc(list, size * sizeof(cdc_chunk))) == NULL)
+				{
+					free(list);
+					free(buff);
+					return MEM_ERROR;
+				}
+				list = tmp;
+			}
+			list[*count].fp = fp;
+			list[*count].offset = start;
+			list[*count].len = len;
+			(*count)++;
+			start += len;
+			len = 0;
+			h = 0;
+			fp = FNV64_OFFSET;
+		}
+		pos += read_len;
+	}
+	free(buff);
+	if (read_len < 0 || pos != cfile_len(cfh))
+	{
+		free(list);
+		*count = 0;
+		return IO_ERROR;
+	}
+	// the tail is too short to be a chunk on its own merits; leave it for the hash passes.
+	*chunks = list;
+	return 0;
+}
@@ -15,7 +15,9 @@
 extern unsigned int verbosity;
 
 static int internal_DCB_llm_resize(DCB_llm *buff);
-static int internal_DCB_llm_free_resize(DCB_llm *buff);
+static int internal_DCB_llm_gap_resize(DCB_llm *dcb, unsigned long count);
+static int internal_DCB_llm_gap_rebuild(DCB_llm *dcb, off_u64 resume);
+static void internal_DCB_llm_flush(DCB_llm *dcb);
 static int internal_DCB_matches_resize(DCB_matches *dcb);
 static int internal_DCB_resize_cl(command_list *cl);
 static inline int internal_DCB_resize_srcs(CommandBuffer *buffer);
@@ -457,70 +459,27 @@ void DCB_test_total_copy_len(CommandBuffer *buff)
 #endif
 }
 
-// collapse this into a loop for adds.
+// walks the gap index; only gaps of at least gap_req are returned.
 unsigned int
 DCB_get_next_gap(CommandBuffer *buff, unsigned long gap_req, DCLoc *dc)
 {
 	DCB_llm *dcb = (DCB_llm *)buff->DCB;
+	DCB_llm_gap *gap;
 	assert(dcb->flags & DCB_LLM_FINALIZED);
-	dc->len = dc->offset = 0;
-
-	if (dcb->gap_pos == buff->ver_size)
-	{
-		return 0;
-	}
-	else if (dcb->gap_pos == 0)
+	dcb->flags &= ~DCB_LLM_GAP_RETURNED;
+	while (dcb->gap_cur < dcb->gap_count)
 	{
-		if (dcb->main_count == 0)
+		gap = dcb->gaps + dcb->gap_cur++;
+		if (gap->len >= gap_req)
 		{
-			if (gap_req <= buff->ver_size)
-			{
-				dc->len = buff->ver_size;
-			}
-			dcb->gap_pos = buff->ver_size;
-			return dc->len != 0;
-		}
-		else if (dcb->main_head->ver_pos >= gap_req)
-		{
-			dcb->gap_pos = dc->len = dcb->main_head->ver_pos;
+			dc->offset = gap->offset;
+			dc->len = gap->len;
+			dcb->gap_last = dcb->gap_cur - 1;
+			dcb->flags |= DCB_LLM_GAP_RETURNED;
 			return 1;
 		}
 	}
-	while (dcb->main != NULL && dcb->gap_pos > dcb->main->ver_pos)
-	{
-		DCBufferIncr(buff);
-	}
-	while (dcb->main != NULL && dc->len == 0)
-	{
-		if (dcb->main->next == NULL)
-		{
-			dcb->gap_pos = buff->ver_size;
-			if (buff->ver_size - LLM_VEND(dcb->main) >= gap_req)
-			{
-				dc->offset = LLM_VEND(dcb->main);
-				dc->len = buff->ver_size - LLM_VEND(dcb->main);
-			}
-			else
-			{
-				DCBufferIncr(buff);
-				return 0;
-			}
-		}
-		else if (dcb->main->next->ver_pos - LLM_VEND(dcb->main) >= gap_req)
-		{
-			dc->offset = LLM_VEND(dcb->main);
-			dc->len = dcb->main->next->ver_pos - dc->offset;
-			dcb->gap_pos = dcb->main->next->ver_pos;
-		}
-		else
-		{
-			DCBufferIncr(buff);
-		}
-	}
-	if (dc->len != 0)
-	{
-		return 1;
-	}
+	dc->len = dc->offset = 0;
 	return 0;
 }
 
@@ -590,7 +549,8 @@ void DCB_llm_get_next(CommandBuffer *buff, DCommand *dc)
 {
 	DCB_llm *dcb = (DCB_llm *)buff->DCB;
 	assert(dcb->flags & DCB_LLM_FINALIZED);
-	if (dcb->main == NULL)
+	assert(dcb->ins_count == 0);
+	if (dcb->main_pos == dcb->main_count)
 	{
 		dc->type = DC_ADD;
 		dc->dcb_src = buff->default_add_src;
@@ -598,13 +558,13 @@ void DCB_llm_get_next(CommandBuffer *buff, DCommand *dc)
 		dc->data.ver_pos = buff->reconstruct_pos;
 		dc->data.len = buff->ver_size - buff->reconstruct_pos;
 	}
-	else if (buff->reconstruct_pos == dcb->main->ver_pos)
+	else if (buff->reconstruct_pos == dcb->main[dcb->main_pos].ver_pos)
 	{
 		dc->type = DC_COPY;
 		dc->dcb_src = buff->default_copy_src;
-		dc->data.src_pos = dcb->main->src_pos;
+		dc->data.src_pos = dcb->main[dcb->main_pos].src_pos;
 		dc->data.ver_pos = buff->reconstruct_pos;
-		dc->data.len = dcb->main->len;
+		dc->data.len = dcb->main[dcb->main_pos].len;
 		DCBufferIncr(buff);
 	}
 	else
@@ -613,7 +573,7 @@ void DCB_llm_get_next(CommandBuffer *buff, DCommand *dc)
 		dc->dcb_src = buff->default_add_src;
 		dc->data.src_pos = buff->reconstruct_pos;
 		dc->data.ver_pos = buff->reconstruct_pos;
-		dc->data.len = dcb->main->ver_pos - buff->reconstruct_pos;
+		dc->data.len = dcb->main[dcb->main_pos].ver_pos - buff->reconstruct_pos;
 	}
 	dc->ov_offset = 0;
 	dc->ov_len = 0;
@@ -751,8 +711,8 @@ void DCB_llm_incr(CommandBuffer *buff)
 	DCB_llm *dcb = (DCB_llm *)buff->DCB;
 	if (dcb->flags & DCB_LLM_FINALIZED)
 	{
-		assert(dcb->main != NULL);
-		dcb->main = dcb->main->next;
+		assert(dcb->main_pos < dcb->main_count);
+		dcb->main_pos++;
 	}
 	else
 	{
@@ -968,7 +928,7 @@ int DCB_rec_copy_from_DCB_src(CommandBuffer *tdcb, command_list *tcl,
 	return 0;
 }
 
-int DCB_add_overlay(CommandBuffer *dcb, off_u64 diff_src_pos, off_u32 len, DCB_SRC_ID add_ov_id,
+int DCB_add_overlay(CommandBuffer *dcb, off_u64 diff_src_pos, off_u64 len, DCB_SRC_ID add_ov_id,
 					off_u64 copy_src_pos, DCB_SRC_ID ov_src_id)
 {
 	// error and sanity checks needed.
@@ -1048,9 +1008,9 @@ int DCB_add_overlay(CommandBuffer *dcb, off_u64 diff_src_pos, off_u32 len, DCB_S
 }
 
 #ifdef DEV_VERSION
-int DCB_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u32 len, DCB_SRC_ID src_id)
+int DCB_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u64 len, DCB_SRC_ID src_id)
 {
-	dcb_lprintf(3, "add src_offset(%llu), len(%u), src_id(%u), reconstruct_position(%llu)\n", (act_off_u64)src_pos, len, src_id,
+	dcb_lprintf(3, "add src_offset(%llu), len(%llu), src_id(%u), reconstruct_position(%llu)\n", (act_off_u64)src_pos, (act_off_u64)len, src_id,
 				(act_off_u64)buffer->reconstruct_pos);
 	if (buffer->add_add)
 		return buffer->add_add(buffer, src_pos, len, src_id);
@@ -1058,7 +1018,7 @@ int DCB_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u32 len, DCB_SRC_ID
 }
 #else
 
-int DCB_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u32 len, DCB_SRC_ID src_id)
+int DCB_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u64 len, DCB_SRC_ID src_id)
 {
 	if (buffer->add_add)
 		return buffer->add_add(buffer, src_pos, len, src_id);
@@ -1067,7 +1027,7 @@ int DCB_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u32 len, DCB_SRC_ID
 
 #endif
 
-int DCB_no_buff_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u32 len, DCB_SRC_ID src_id)
+int DCB_no_buff_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u64 len, DCB_SRC_ID src_id)
 {
 	DCB_no_buff *dcb = (DCB_no_buff *)buffer->DCB;
 	dcb->dc.type = (buffer->srcs[src_id].type & 0x1);
@@ -1086,7 +1046,27 @@ int DCB_no_buff_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u32 len, DCB
 	return 0;
 }
 
-int DCB_full_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u32 len, DCB_SRC_ID src_id)
+int DCB_stream_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u64 len, DCB_SRC_ID src_id)
+{
+	DCB_stream *dcb = (DCB_stream *)buffer->DCB;
+	int err;
+	dcb->dc.type = DC_ADD;
+	dcb->dc.data.src_pos = src_pos;
+	dcb->dc.data.ver_pos = buffer->reconstruct_pos;
+	dcb->dc.data.len = len;
+	dcb->dc.src_id = src_id;
+	dcb->dc.dcb_ptr = buffer;
+	dcb->dc.dcb_src = buffer->srcs + src_id;
+	if ((err = dcb->emit(dcb->emit_data, &dcb->dc)) != 0)
+	{
+		dcb_lprintf(0, "error emitting add during stream mode\n");
+		return err;
+	}
+	buffer->reconstruct_pos += len;
+	return 0;
+}
+
+int DCB_full_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u64 len, DCB_SRC_ID src_id)
 {
 	DCB_full *dcb = (DCB_full *)buffer->DCB;
 
@@ -1103,19 +1083,19 @@ int DCB_full_add_add(CommandBuffer *buffer, off_u64 src_pos, off_u32 len, DCB_SR
 }
 
 #ifdef DEV_VERSION
-int DCB_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u32 len, DCB_SRC_ID src_id)
+int DCB_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u64 len, DCB_SRC_ID src_id)
 {
 #ifdef DEBUG_DCBUFFER
 	buffer->total_copy_len += len;
 #endif
 
-	dcb_lprintf(3, "copy src_offset(%llu), version_offset(%llu), len(%u), reconstruct_position(%llu)\n", (act_off_u64)src_pos, (act_off_u64)ver_pos,
-				len, (act_off_u64)buffer->reconstruct_pos);
+	dcb_lprintf(3, "copy src_offset(%llu), version_offset(%llu), len(%llu), reconstruct_position(%llu)\n", (act_off_u64)src_pos, (act_off_u64)ver_pos,
+				(act_off_u64)len, (act_off_u64)buffer->reconstruct_pos);
 	return buffer->add_copy(buffer, src_pos, ver_pos, len, src_id);
 }
 #endif
 
-int DCB_no_buff_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u32 len, DCB_SRC_ID src_id)
+int DCB_no_buff_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u64 len, DCB_SRC_ID src_id)
 {
 	DCB_no_buff *dcb = (DCB_no_buff *)buffer->DCB;
 	dcb->dc.type = (buffer->srcs[src_id].type & 0x1);
@@ -1134,7 +1114,29 @@ int DCB_no_buff_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos
 	return 0;
 }
 
-int DCB_full_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u32 len, DCB_SRC_ID src_id)
+int DCB_stream_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u64 len, DCB_SRC_ID src_id)
+{
+	DCB_stream *dcb = (DCB_stream *)buffer->DCB;
+	int err;
+	// commands have to arrive in version order; there's no buffer to sort them in.
+	assert(ver_pos == buffer->reconstruct_pos);
+	dcb->dc.type = DC_COPY;
+	dcb->dc.data.src_pos = src_pos;
+	dcb->dc.data.ver_pos = ver_pos;
+	dcb->dc.data.len = len;
+	dcb->dc.src_id = src_id;
+	dcb->dc.dcb_ptr = buffer;
+	dcb->dc.dcb_src = buffer->srcs + src_id;
+	if ((err = dcb->emit(dcb->emit_data, &dcb->dc)) != 0)
+	{
+		dcb_lprintf(0, "error emitting copy during stream mode\n");
+		return err;
+	}
+	buffer->reconstruct_pos += len;
+	return 0;
+}
+
+int DCB_full_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u64 len, DCB_SRC_ID src_id)
 {
 	unsigned long index;
 	DCB_full *dcb = (DCB_full *)buffer->DCB;
@@ -1180,7 +1182,7 @@ int DCB_full_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, o
 	return 0;
 }
 
-int DCB_matches_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u32 len, DCB_SRC_ID src_id)
+int DCB_matches_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u64 len, DCB_SRC_ID src_id)
 {
 	DCB_matches *dcb = (DCB_matches *)buffer->DCB;
 	if (dcb->buff_count == dcb->buff_size)
@@ -1198,7 +1200,7 @@ int DCB_matches_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos
 	return 0;
 }
 
-int DCB_llm_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u32 len, DCB_SRC_ID src_id)
+int DCB_llm_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, off_u64 len, DCB_SRC_ID src_id)
 {
 	DCB_llm *dcb = (DCB_llm *)buffer->DCB;
 	assert((DCB_LLM_FINALIZED & dcb->flags) == 0);
@@ -1220,34 +1222,185 @@ int DCB_llm_add_copy(CommandBuffer *buffer, off_u64 src_pos, off_u64 ver_pos, of
 }
 
 static int
-internal_DCB_llm_free_resize(DCB_llm *buff)
+internal_DCB_llm_resize(DCB_llm *buff)
 {
-	if ((buff->free = (void **)realloc(buff->free, buff->free_size * 2 * sizeof(void *))) == NULL)
+	DCLoc_match *tmp;
+	assert(buff->buff_count <= buff->buff_size);
+	dcb_lprintf(3, "resizing ll_matches buffer from %u to %u\n", buff->buff_size, buff->buff_size * 2);
+	if ((tmp = (DCLoc_match *)realloc(buff->buff, buff->buff_size * 2 * sizeof(DCLoc_match))) == NULL)
 	{
 		return MEM_ERROR;
 	}
-	buff->free_size *= 2;
+	buff->buff = tmp;
+	buff->buff_size *= 2;
+	buff->cur = buff->buff + buff->buff_count;
 	return 0;
 }
 
+// make room for count more matches, between main and the insert queue.
 static int
-internal_DCB_llm_resize(DCB_llm *buff)
+internal_DCB_llm_main_resize(DCB_llm *dcb, unsigned long count)
+{
+	DCLoc_match *tmp;
+	unsigned long *at, size;
+	if (dcb->main_count + dcb->ins_count + count > dcb->main_size)
+	{
+		for (size = MAX(dcb->main_size, 128); size < dcb->main_count + dcb->ins_count + count; size *= 2)
+			;
+		if ((tmp = (DCLoc_match *)realloc(dcb->main, size * sizeof(DCLoc_match))) == NULL)
+			return MEM_ERROR;
+		dcb->main = tmp;
+		dcb->main_size = size;
+	}
+	if (dcb->ins_count + count > dcb->ins_size)
+	{
+		for (size = MAX(dcb->ins_size, 128); size < dcb->ins_count + count; size *= 2)
+			;
+		if ((tmp = (DCLoc_match *)realloc(dcb->ins, size * sizeof(DCLoc_match))) == NULL)
+			return MEM_ERROR;
+		dcb->ins = tmp;
+		if ((at = (unsigned long *)realloc(dcb->ins_at, size * sizeof(unsigned long))) == NULL)
+			return MEM_ERROR;
+		dcb->ins_at = at;
+		dcb->ins_size = size;
+	}
+	return 0;
+}
+
+/* merge the insert queue into main, back to front so nothing moves twice, and swap in the
+   split gap index.  main_resize already made the room. */
+static void
+internal_DCB_llm_flush(DCB_llm *dcb)
 {
+	DCB_llm_gap *tmp;
+	unsigned long x, i = dcb->main_count, j = dcb->ins_count, w = dcb->main_count + dcb->ins_count;
+	if (dcb->gap_copied)
+	{
+		// every queued match lands before the gaps past the last split.
+		for (x = dcb->gap_copied; x < dcb->gap_count; x++)
+		{
+			dcb->gap_next[dcb->gap_next_count] = dcb->gaps[x];
+			dcb->gap_next[dcb->gap_next_count++].at += dcb->ins_count;
+		}
+		dcb->gap_count = dcb->gap_next_count;
+		tmp = dcb->gaps;
+		dcb->gaps = dcb->gap_next;
+		dcb->gap_next = tmp;
+	}
+	dcb->gap_next_count = dcb->gap_copied = 0;
+	dcb->flags &= ~DCB_LLM_GAP_RETURNED;
+
+	assert(w <= dcb->main_size || j == 0);
+	while (j > 0)
+	{
+		if (i > dcb->ins_at[j - 1])
+			dcb->main[--w] = dcb->main[--i];
+		else
+			dcb->main[--w] = dcb->ins[--j];
+	}
+	dcb->main_count += dcb->ins_count;
+	dcb->ins_count = 0;
+}
+
+// grow both gap arrays to hold at least count gaps.
+static int
+internal_DCB_llm_gap_resize(DCB_llm *dcb, unsigned long count)
+{
+	DCB_llm_gap *tmp;
+	unsigned long size = (dcb->gap_size ? dcb->gap_size : 16);
+	while (size < count)
+		size *= 2;
+	if (size == dcb->gap_size)
+		return 0;
+	if ((tmp = (DCB_llm_gap *)realloc(dcb->gaps, size * sizeof(DCB_llm_gap))) == NULL)
+		return MEM_ERROR;
+	dcb->gaps = tmp;
+	if ((tmp = (DCB_llm_gap *)realloc(dcb->gap_next, size * sizeof(DCB_llm_gap))) == NULL)
+		return MEM_ERROR;
+	dcb->gap_next = tmp;
+	dcb->gap_size = size;
+	return 0;
+}
+
+
+/* recompute the gap index from main, w/ the queue already merged; enumeration picks up at the
+   first gap starting at or after resume. */
+static int
+internal_DCB_llm_gap_rebuild(DCB_llm *dcb, off_u64 resume)
+{
+	DCB_llm_gap *gap;
+	off_u64 pos = dcb->ver_start;
 	unsigned long x;
-	assert(buff->buff_count <= buff->buff_size);
-	dcb_lprintf(3, "resizing ll_matches buffer from %u to %u\n", buff->buff_size, buff->buff_size * 2);
-	buff->buff_size *= 2;
-	if ((buff->buff = (LL_DCLmatch *)realloc(buff->buff, buff->buff_size * sizeof(LL_DCLmatch))) == NULL)
+	assert(dcb->ins_count == 0);
+	if (internal_DCB_llm_gap_resize(dcb, dcb->main_count + 1))
+		return MEM_ERROR;
+	gap = dcb->gaps;
+	for (x = 0; x < dcb->main_count; x++)
+	{
+		if (dcb->main[x].ver_pos > pos)
+		{
+			gap->offset = pos;
+			gap->len = dcb->main[x].ver_pos - pos;
+			gap->at = x;
+			gap++;
+		}
+		pos = LLM_VEND(dcb->main + x);
+	}
+	if (dcb->ver_end > pos)
 	{
+		gap->offset = pos;
+		gap->len = dcb->ver_end - pos;
+		gap->at = dcb->main_count;
+		gap++;
+	}
+	dcb->gap_count = gap - dcb->gaps;
+	dcb->gap_next_count = dcb->gap_copied = 0;
+	dcb->flags &= ~DCB_LLM_GAP_RETURNED;
+	for (dcb->gap_cur = 0; dcb->gap_cur < dcb->gap_count && dcb->gaps[dcb->gap_cur].offset < resume; dcb->gap_cur++)
+		;
+	return 0;
+}
+
+/* replace the gap last handed out w/ what's left of it around buff, which is about to be queued.
+   Queued matches all land before it, so indexes into main shift by ins_count. */
+static int
+internal_DCB_llm_gap_split(DCB_llm *dcb)
+{
+	DCB_llm_gap split, *gap;
+	unsigned long x;
+	off_u64 pos;
+	assert(dcb->flags & DCB_LLM_GAP_RETURNED);
+	if (internal_DCB_llm_gap_resize(dcb, dcb->gap_next_count + dcb->gap_count - dcb->gap_copied + dcb->buff_count))
 		return MEM_ERROR;
+	split = dcb->gaps[dcb->gap_last];
+	gap = dcb->gap_next + dcb->gap_next_count;
+	for (x = dcb->gap_copied; x < dcb->gap_last; x++, gap++)
+	{
+		*gap = dcb->gaps[x];
+		gap->at += dcb->ins_count;
 	}
-	buff->cur = buff->buff + buff->buff_count;
-	for (x = buff->buff_count; x < buff->buff_size; x++)
+	pos = split.offset;
+	for (x = 0; x < dcb->buff_count; x++)
+	{
+		if (dcb->buff[x].ver_pos > pos)
+		{
+			gap->offset = pos;
+			gap->len = dcb->buff[x].ver_pos - pos;
+			gap->at = split.at + dcb->ins_count + x;
+			gap++;
+		}
+		pos = LLM_VEND(dcb->buff + x);
+	}
+	if (split.offset + split.len > pos)
 	{
-		buff->buff[x].next = NULL;
-		buff->buff[x].len = 0;
-		buff->buff[x].src_pos = buff->buff[x].ver_pos = 0;
+		gap->offset = pos;
+		gap->len = split.offset + split.len - pos;
+		gap->at = split.at + dcb->ins_count + dcb->buff_count;
+		gap++;
 	}
+	dcb->gap_next_count = gap - dcb->gap_next;
+	dcb->gap_copied = dcb->gap_last + 1;
+	dcb->flags &= ~DCB_LLM_GAP_RETURNED;
 	return 0;
 }
 
@@ -1265,8 +1418,8 @@ void DCB_llm_reset(void *dcb)
 {
 	DCB_llm *dcb_llm = (DCB_llm *)dcb;
 	assert(DCB_LLM_FINALIZED & dcb_llm->flags);
-	dcb_llm->main = dcb_llm->main_head;
-	dcb_llm->gap_pos = dcb_llm->ver_start;
+	internal_DCB_llm_flush(dcb_llm);
+	dcb_llm->main_pos = dcb_llm->gap_cur = 0;
 }
 
 int DCB_full_commands_remain(void *dcb)
@@ -1288,12 +1441,16 @@ void DCB_matches_free(void *dcb)
 
 void DCB_llm_free(void *dcb)
 {
-	unsigned long x;
 	DCB_llm *dcb_llm = (DCB_llm *)dcb;
-	for (x = 0; x < dcb_llm->free_count; x++)
-		free(dcb_llm->free[x]);
-	free(dcb_llm->free);
-	dcb_llm->free = NULL;
+	free(dcb_llm->main);
+	free(dcb_llm->ins);
+	free(dcb_llm->ins_at);
+	free(dcb_llm->buff);
+	free(dcb_llm->gaps);
+	free(dcb_llm->gap_next);
+	dcb_llm->main = dcb_llm->ins = dcb_llm->buff = dcb_llm->cur = NULL;
+	dcb_llm->ins_at = NULL;
+	dcb_llm->gaps = dcb_llm->gap_next = NULL;
 }
 
 void DCBufferFree(CommandBuffer *buffer)
@@ -1384,6 +1541,32 @@ int DCB_no_buff_init(CommandBuffer *buffer, unsigned long buffer_size, off_u64 s
 	return 0;
 }
 
+/* like no_buff, but rather than reconstructing, every command goes straight to emit; used to write
+   patches incrementally. */
+int DCB_stream_init(CommandBuffer *buffer, off_u64 src_size, off_u64 ver_size, dcb_stream_emit_func emit,
+					void *emit_data)
+{
+	DCB_stream *dcb;
+	if (DCB_common_init(buffer, 0, src_size, ver_size, DCBUFFER_STREAM_TYPE))
+		return MEM_ERROR;
+	else if ((dcb = (DCB_stream *)malloc(sizeof(DCB_stream))) == NULL)
+	{
+		free(buffer->srcs);
+		buffer->srcs = NULL;
+		return MEM_ERROR;
+	}
+	memset(&dcb->dc, 0, sizeof(DCommand));
+	dcb->emit = emit;
+	dcb->emit_data = emit_data;
+
+	buffer->DCB = (void *)dcb;
+
+	buffer->add_add = DCB_stream_add_add;
+	buffer->add_copy = DCB_stream_add_copy;
+
+	return 0;
+}
+
 int DCB_full_init(CommandBuffer *buffer, unsigned long buffer_size, off_u64 src_size, off_u64 ver_size)
 {
 	DCB_full *dcb;
@@ -1463,23 +1646,27 @@ int DCB_llm_init(CommandBuffer *buffer, unsigned long buffer_size, off_u64 src_s
 		buffer->srcs = NULL;
 		return MEM_ERROR;
 	}
-	dcb->main = dcb->main_head = NULL;
-	if ((dcb->free = (void **)malloc(10 * sizeof(void *))) == NULL)
+	dcb->main = dcb->ins = dcb->buff = dcb->cur = NULL;
+	dcb->ins_at = NULL;
+	dcb->gaps = dcb->gap_next = NULL;
+	dcb->main_count = dcb->main_size = dcb->main_pos = 0;
+	dcb->ins_count = dcb->ins_size = 0;
+	dcb->buff_count = dcb->buff_size = 0;
+	dcb->gap_size = 0;
+	dcb->ver_start = 0;
+	dcb->ver_end = ver_size;
+	dcb->flags = DCB_LLM_FINALIZED;
+	if (internal_DCB_llm_gap_rebuild(dcb, 0))
 	{
+		free(dcb->gaps);
+		free(dcb->gap_next);
 		free(buffer->srcs);
 		buffer->srcs = NULL;
 		free(dcb);
 		return MEM_ERROR;
 	}
-	dcb->free_size = 10;
-	dcb->free_count = 0;
-	dcb->buff_count = dcb->main_count = dcb->buff_size = 0;
-	dcb->ver_start = 0;
-	dcb->flags = DCB_LLM_FINALIZED;
 	buffer->DCB = (void *)dcb;
 
-	dcb->buff = dcb->cur = NULL;
-
 	buffer->add_copy = DCB_llm_add_copy;
 	buffer->incr = DCB_llm_incr;
 	buffer->decr = DCB_llm_decr;
@@ -1520,32 +1707,22 @@ internal_DCB_resize_cl(command_list *cl)
 unsigned int
 DCB_test_llm_main(CommandBuffer *buff)
 {
-	/*	LL_DCLmatch *ptr;
-	unsigned long cur_pos, count=0;
+	DCB_llm *dcb = (DCB_llm *)buff->DCB;
+	unsigned long x;
 	assert(DCBUFFER_LLMATCHES_TYPE == buff->DCBtype);
-	if(buff->DCB.llm.main_head != NULL) {
-		ptr = buff->DCB.llm.main_head;
-		cur_pos = ptr->ver_pos;
-		while(ptr != NULL && ptr->next != NULL) {
-			assert(ptr->len < MIN(buff->ver_size, buff->src_size));
-			assert(ptr->ver_pos + ptr->len <= buff->ver_size);
-			assert(ptr->src_pos + ptr->len <= buff->src_size);
-			assert(cur_pos <= ptr->ver_pos + ptr->len);
-			cur_pos = ptr->ver_pos + ptr->len;
-			ptr = ptr->next;
-			count++;
-		}
-	} else {
-		dcb_lprintf(1, "main_head is empty, can't test it...\n");
+	for (x = 0; x < dcb->main_count; x++)
+	{
+		assert(LLM_VEND(dcb->main + x) <= buff->ver_size);
+		assert(dcb->main[x].src_pos + dcb->main[x].len <= buff->src_size);
+		assert(x == 0 || LLM_VEND(dcb->main + x - 1) <= dcb->main[x].ver_pos);
 	}
-*/
 	return 1;
 }
 
 int cmp_llmatch(void *dl1, void *dl2)
 {
-	LL_DCLmatch *d1 = (LL_DCLmatch *)dl1;
-	LL_DCLmatch *d2 = (LL_DCLmatch *)dl2;
+	DCLoc_match *d1 = (DCLoc_match *)dl1;
+	DCLoc_match *d2 = (DCLoc_match *)dl2;
 	if (d1->ver_pos < d2->ver_pos)
 		return -1;
 	else if (d1->ver_pos > d2->ver_pos)
@@ -1560,60 +1737,57 @@ int cmp_llmatch(void *dl1, void *dl2)
 int DCB_llm_finalize(void *d_ptr)
 {
 	DCB_llm *dcb = (DCB_llm *)d_ptr;
-	unsigned long x;
+	DCB_llm_gap *gap = NULL;
+	unsigned long x, at, lo, hi;
+	int err;
 	if (dcb->buff_count > 0)
 	{
 		dcb->cur--;
 		dcb_lprintf(2, "inserting a segment %llu:%llu, commands(%u)\n",
 					(act_off_u64)dcb->buff->ver_pos, (act_off_u64)(LLM_VEND(dcb->cur)),
 					dcb->buff_count);
-
-		assert(dcb->main_head == NULL ? dcb->main == NULL : 1);
-		if ((dcb->buff = (LL_DCLmatch *)realloc(dcb->buff, dcb->buff_count * sizeof(LL_DCLmatch))) == NULL)
-		{
-			return MEM_ERROR;
-		}
-		// link the buggers
-		for (x = 0; x < dcb->buff_count - 1; x++)
+		if ((err = internal_DCB_llm_main_resize(dcb, dcb->buff_count)) != 0)
+			return err;
+		if (dcb->flags & DCB_LLM_GAP_RETURNED)
 		{
-			dcb->buff[x].next = dcb->buff + x + 1;
+			gap = dcb->gaps + dcb->gap_last;
+			if (dcb->buff->ver_pos < gap->offset || LLM_VEND(dcb->cur) > gap->offset + gap->len)
+				gap = NULL;
 		}
-		dcb->cur = dcb->buff + dcb->buff_count - 1;
-		if (dcb->main_head == NULL)
+		if (gap != NULL)
 		{
-			//no commands exist yet
-			dcb_lprintf(2, "main is empty\n");
-			dcb->main_head = dcb->buff;
-			dcb->main = dcb->cur;
-			dcb->main->next = NULL;
+			at = gap->at;
+			if ((err = internal_DCB_llm_gap_split(dcb)) != 0)
+				return err;
 		}
-		else if (dcb->main_head->ver_pos >= dcb->cur->ver_pos)
+		else
 		{
-			// prepending it
-			dcb_lprintf(2, "prepending commands\n");
-			dcb->cur->next = dcb->main;
-			dcb->main_head = dcb->buff;
+			// not w/in the gap being worked; merge what's queued and bsearch for where it goes.
+			dcb_lprintf(2, "searching for the insert point\n");
+			internal_DCB_llm_flush(dcb);
+			for (lo = 0, hi = dcb->main_count; lo < hi;)
+			{
+				if (dcb->main[(lo + hi) / 2].ver_pos < dcb->buff->ver_pos)
+					lo = (lo + hi) / 2 + 1;
+				else
+					hi = (lo + hi) / 2;
+			}
+			at = lo;
 		}
-		else
+		for (x = 0; x < dcb->buff_count; x++)
 		{
-			dcb_lprintf(2, "gen. insert\n");
-			dcb->cur->next = dcb->main->next;
-			dcb->main->next = dcb->buff;
-			dcb->main = dcb->cur;
+			dcb->ins[dcb->ins_count] = dcb->buff[x];
+			dcb->ins_at[dcb->ins_count++] = at;
 		}
-		dcb->main_count += dcb->buff_count;
-		if (dcb->free_count == dcb->free_size)
+		if (gap == NULL)
 		{
-			internal_DCB_llm_free_resize(dcb);
+			internal_DCB_llm_flush(dcb);
+			if ((err = internal_DCB_llm_gap_rebuild(dcb, LLM_VEND(dcb->cur))) != 0)
+				return err;
 		}
-		dcb->free[dcb->free_count++] = dcb->buff;
 	}
-	else if (!(dcb->flags & DCB_LLM_FINALIZED))
-	{
-		free(dcb->buff);
-	}
-	dcb->buff = dcb->cur = NULL;
-	dcb->buff_count = dcb->buff_size = 0;
+	dcb->cur = dcb->buff;
+	dcb->buff_count = 0;
 	dcb->flags |= DCB_LLM_FINALIZED;
 	return 0;
 }
@@ -1621,15 +1795,20 @@ int DCB_llm_finalize(void *d_ptr)
 int DCB_llm_init_buff(CommandBuffer *buff, unsigned int buff_size)
 {
 	DCB_llm *dcb = (DCB_llm *)buff->DCB;
+	DCLoc_match *tmp;
 	dcb_lprintf(3, "llm_init_buff called\n");
 	assert(DCBUFFER_LLMATCHES_TYPE == buff->DCBtype);
 	assert(dcb->flags & DCB_LLM_FINALIZED);
-	if ((dcb->buff = (LL_DCLmatch *)malloc(buff_size * sizeof(LL_DCLmatch))) == NULL)
+	if (dcb->buff_size < buff_size)
 	{
-		return MEM_ERROR;
+		if ((tmp = (DCLoc_match *)realloc(dcb->buff, buff_size * sizeof(DCLoc_match))) == NULL)
+		{
+			return MEM_ERROR;
+		}
+		dcb->buff = tmp;
+		dcb->buff_size = buff_size;
 	}
 	dcb->cur = dcb->buff;
-	dcb->buff_size = buff_size;
 	dcb->buff_count = 0;
 	dcb->flags &= ~DCB_LLM_FINALIZED;
 	return 0;
@@ -1,14 +1,20 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // Copyright (C) 2003-2015 Brian Harring <ferringb@gmail.com>
 #include <stdlib.h>
+#include <pthread.h>
 #include <diffball/defs.h>
 #include <errno.h>
 #include <string.h>
 #include <diffball/adler32.h>
 #include <diffball/diff-algs.h>
 #include <diffball/hash.h>
+#include <diffball/suffix.h>
+#include <diffball/cdc.h>
 #include <diffball/defs.h>
 #include <diffball/bit-functions.h>
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /* this is largely based on the algorithms detailed in randal burn's various papers.
    Obviously credit for the alg's go to him, although I'm the one who gets the dubious
@@ -23,25 +29,103 @@
 		return (value);                                                                        \
 	}
 
-signed int
-OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile *vcfh, unsigned char vid)
+/* number of leading bytes v and r agree on, up to max. */
+static unsigned long
+match_forward(const unsigned char *v, const unsigned char *r, unsigned long max)
+{
+	unsigned long x = 0;
+#if defined(__GNUC__) && defined(__SSE2__)
+	unsigned int mask;
+	for (; x + 16 <= max; x += 16)
+	{
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(v + x)),
+												_mm_loadu_si128((const __m128i *)(r + x))));
+		if (mask != 0xffff)
+			return x + __builtin_ctz(~mask);
+	}
+#else
+	unsigned long long a, b;
+	for (; x + 8 <= max; x += 8)
+	{
+		memcpy(&a, v + x, 8);
+		memcpy(&b, r + x, 8);
+		if (a != b)
+			break;
+	}
+#endif
+	while (x < max && v[x] == r[x])
+		x++;
+	return x;
+}
+
+/* number of bytes immediately preceding v and r that agree, up to max. */
+static unsigned long
+match_backward(const unsigned char *v, const unsigned char *r, unsigned long max)
+{
+	unsigned long x = 0;
+#if defined(__GNUC__) && defined(__SSE2__)
+	unsigned int mask;
+	for (; x + 16 <= max; x += 16)
+	{
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(v - x - 16)),
+												_mm_loadu_si128((const __m128i *)(r - x - 16))));
+		if (mask != 0xffff)
+			return x + __builtin_clz((~mask & 0xffff) << 16);
+	}
+#else
+	unsigned long long a, b;
+	for (; x + 8 <= max; x += 8)
+	{
+		memcpy(&a, v - x - 8, 8);
+		memcpy(&b, r - x - 8, 8);
+		if (a != b)
+			break;
+	}
+#endif
+	while (x < max && v[-1 - (long)x] == r[-1 - (long)x])
+		x++;
+	return x;
+}
+
+typedef struct
+{
+	RefHash *rh;
+	cfile *ref_cfh;
+	cfile *ver_cfh;
+	off_u64 ver_range_start;
+	off_u64 ver_range_end;
+	CommandBuffer matches;
+	unsigned long good_matches;
+	unsigned long bad_matches;
+	int err;
+} OHPC_range;
+
+/* the actual match loop.  Only version offsets w/in [ver_range_start, ver_range_end) are tried as
+   match starts, but matches are free to extend past either edge.  ref_cfh must be a handle onto
+   the same data as rh->ref_cfh; threaded callers hand in their own so the cfile windows aren't shared.
+   Verified and collided lookups are added to *good and *bad. */
+static signed int
+internal_OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, cfile *ref_cfh, unsigned char rid,
+							   cfile *vcfh, unsigned char vid, off_u64 ver_range_start, off_u64 ver_range_end,
+							   unsigned long *good, unsigned long *bad)
 {
-	ADLER32_SEED_CTX ads;
-	off_u32 va, vs, vc, vm, rm, ver_len, len, ref_len, ver_start, ref_start;
+	ADLER32_SEED_CTX ads, probe;
+	off_u64 va, vs, vc, vm, rm, ver_len, len, ref_len, ver_start, ref_start, span;
 	cfile_window *vcfw, *rcfw;
 	unsigned long bad_match = 0, no_match = 0, good_match = 0;
 	unsigned long hash_offset, x;
+	unsigned long chksums[ADLER32_BLOCK_LEN];
 	int err;
 	err = init_adler32_seed(&ads, rh->seed_len);
 	if (err)
 		ERETURN(err);
-	va = vs = vc = 0;
+	va = vs = vc = ver_range_start;
 	ver_len = cfile_len(vcfh);
 	ver_start = cfile_start_offset(vcfh);
-	ref_len = cfile_len(rh->ref_cfh);
-	ref_start = cfile_start_offset(rh->ref_cfh);
+	ref_len = cfile_len(ref_cfh);
+	ref_start = cfile_start_offset(ref_cfh);
 
-	if (0 != cseek(vcfh, 0, CSEEK_FSTART))
+	if (ver_range_start != cseek(vcfh, ver_range_start, CSEEK_FSTART))
 	{
 		ERETURN(IO_ERROR);
 	}
@@ -50,7 +134,7 @@ OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile
 		ERETURN(IO_ERROR);
 
 #define end_pos(x) ((x)->offset + (x)->end)
-	while (vcfw != NULL)
+	while (vcfw != NULL && vc < ver_range_end)
 	{
 		if (va < vc)
 		{
@@ -90,21 +174,52 @@ OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile
 		{
 			vc++;
 			no_match++;
-			continue;
+			if (vc >= ver_range_end || va >= end_pos(vcfw) || va - vcfw->offset < rh->seed_len)
+				continue;
+			// roll a block of windows at once; on a hit, reseed ads at that window.
+			x = MIN(end_pos(vcfw) - va, ver_range_end - vc);
+			len = MIN(x, ADLER32_BLOCK_LEN);
+			adler32_roll_block(&ads, vcfw->buff + va - vcfw->offset, len, chksums);
+			// pipeline the lookups; keep RH_PREFETCH_DISTANCE buckets in flight ahead of the probe.
+			for (x = 0; x < MIN(len, RH_PREFETCH_DISTANCE); x++)
+			{
+				prefetch_lookup(rh, chksums[x]);
+			}
+			probe = ads;
+			for (x = 0; x < len; x++)
+			{
+				if (x + RH_PREFETCH_DISTANCE < len)
+				{
+					prefetch_lookup(rh, chksums[x + RH_PREFETCH_DISTANCE]);
+				}
+				probe.s2 = chksums[x];
+				hash_offset = lookup_offset(rh, &probe);
+				if (hash_offset != 0)
+					break;
+			}
+			no_match += x;
+			vc += x;
+			if (hash_offset == 0)
+			{
+				va += len;
+				continue;
+			}
+			va = vc + rh->seed_len;
+			update_adler32_seed(&ads, vcfw->buff + vc - vcfw->offset, rh->seed_len);
 		}
-		if (hash_offset != cseek(rh->ref_cfh, hash_offset, CSEEK_FSTART))
+		if (hash_offset != cseek(ref_cfh, hash_offset, CSEEK_FSTART))
 		{
 			ERETURN(IO_ERROR);
 		}
 
-		rcfw = expose_page(rh->ref_cfh);
+		rcfw = expose_page(ref_cfh);
 		//verify we haven't hit checksum collision
 		vm = vc;
 		for (x = 0; x < rh->seed_len; x++)
 		{
 			if (rcfw->pos == rcfw->end)
 			{
-				rcfw = next_page(rh->ref_cfh);
+				rcfw = next_page(ref_cfh);
 				if (rcfw == NULL || rcfw->end == 0)
 				{
 					ERETURN(IO_ERROR);
@@ -125,7 +240,7 @@ OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile
 		//back matching
 		vm = vc;
 		rm = hash_offset;
-		cseek(rh->ref_cfh, rm, CSEEK_FSTART);
+		cseek(ref_cfh, rm, CSEEK_FSTART);
 		cseek(vcfh, vm, CSEEK_FSTART);
 
 		while (vm > 0 && rm > 0)
@@ -140,7 +255,7 @@ OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile
 			while (rcfw->offset > rm - 1)
 			{
 				assert(end_pos(rcfw) > rm - 1);
-				rcfw = prev_page(rh->ref_cfh);
+				rcfw = prev_page(ref_cfh);
 				if (rcfw->end == 0)
 					ERETURN(IO_ERROR);
 			}
@@ -148,15 +263,13 @@ OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile
 			assert(rm - 1 >= rcfw->offset);
 			assert(end_pos(vcfw) > vm - 1);
 			assert(end_pos(rcfw) > rm - 1);
-			if (vcfw->buff[vm - 1 - vcfw->offset] == rcfw->buff[rm - 1 - rcfw->offset])
-			{
-				rm--;
-				vm--;
-			}
-			else
-			{
+			// compare everything both windows hold; only step pages once one is exhausted.
+			span = MIN(vm - vcfw->offset, rm - rcfw->offset);
+			x = match_backward(vcfw->buff + vm - vcfw->offset, rcfw->buff + rm - rcfw->offset, span);
+			vm -= x;
+			rm -= x;
+			if (x < span)
 				break;
-			}
 		}
 		len = vc + rh->seed_len - vm;
 
@@ -168,9 +281,9 @@ OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile
 		if (vcfw->end == 0 && vcfw->offset != ver_len)
 			ERETURN(IO_ERROR);
 
-		if (rm + len != cseek(rh->ref_cfh, rm + len, CSEEK_FSTART))
+		if (rm + len != cseek(ref_cfh, rm + len, CSEEK_FSTART))
 			ERETURN(IO_ERROR);
-		rcfw = expose_page(rh->ref_cfh);
+		rcfw = expose_page(ref_cfh);
 		if (rcfw->end == 0 && rcfw->offset != ref_len)
 			ERETURN(IO_ERROR);
 
@@ -191,7 +304,7 @@ OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile
 
 			if (rm + len >= end_pos(rcfw))
 			{
-				rcfw = next_page(rh->ref_cfh);
+				rcfw = next_page(ref_cfh);
 				if (rcfw->end == 0)
 				{
 					if (rcfw->offset != ref_len)
@@ -202,14 +315,12 @@ OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile
 			assert(rm + len < rcfw->offset + rcfw->end);
 			assert(rm + len >= rcfw->offset);
 
-			if (vcfw->buff[vm + len - vcfw->offset] == rcfw->buff[rm + len - rcfw->offset])
-			{
-				len++;
-			}
-			else
-			{
+			span = MIN(end_pos(vcfw) - (vm + len), end_pos(rcfw) - (rm + len));
+			span = MIN(span, MIN(ver_len - (vm + len), ref_len - (rm + len)));
+			x = match_forward(vcfw->buff + vm + len - vcfw->offset, rcfw->buff + rm + len - rcfw->offset, span);
+			len += x;
+			if (x < span)
 				break;
-			}
 		}
 		if (vs <= vm)
 		{
@@ -221,40 +332,467 @@ OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile
 		}
 		else
 		{
-			DCB_truncate(dcb, vs - vm);
+			// only truncate what this range emitted; anything prior belongs to someone else.
+			if (vs > ver_range_start)
+			{
+				DCB_truncate(dcb, vs - MAX(vm, ver_range_start));
+			}
 			DCB_add_copy(dcb, ref_start + rm, ver_start + vm, len, rid);
 		}
 		vs = vc = vm + len;
 	}
-	if (vs != ver_len)
-		DCB_add_add(dcb, ver_start + vs, ver_len - vs, vid);
+	if (vs < ver_range_end)
+		DCB_add_add(dcb, ver_start + vs, ver_range_end - vs, vid);
 	free_adler32_seed(&ads);
+	*good += good_match;
+	*bad += bad_match;
 	return 0;
 }
 
+signed int
+OneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile *vcfh, unsigned char vid)
+{
+	return internal_OneHalfPassCorrecting(dcb, rh, rh->ref_cfh, rid, vcfh, vid, 0, cfile_len(vcfh),
+										  &rh->good_matches, &rh->bad_matches);
+}
+
+static void *
+OHPC_range_thread(void *data)
+{
+	OHPC_range *r = (OHPC_range *)data;
+	r->err = internal_OneHalfPassCorrecting(&r->matches, r->rh, r->ref_cfh, 0, r->ver_cfh, 0,
+											r->ver_range_start, r->ver_range_end, &r->good_matches, &r->bad_matches);
+	return NULL;
+}
+
+/* Split the version file into thread_count ranges, and run the match loop for each against the
+   shared (read only at this point) RefHash.  Each range collects into a private matches buffer;
+   they're then stitched into dcb in order.  A match from range n may run into range n+1- where
+   they overlap, the earlier match wins and the later one is trimmed to start where it ends. */
+signed int
+ParallelOneHalfPassCorrecting(CommandBuffer *dcb, RefHash *rh, unsigned char rid, cfile *vcfh, unsigned char vid,
+							  unsigned int thread_count)
+{
+	OHPC_range *ranges;
+	pthread_t *threads;
+	DCLoc_match *m;
+	off_u64 ver_len, ver_start, range_len, vs, skip;
+	unsigned int x, y;
+	int err = 0;
+
+	ver_len = cfile_len(vcfh);
+	thread_count = MIN(thread_count, ver_len / MIN_PARALLEL_RANGE_LEN);
+	// compressed and multifile handles still share raw lseek state across children.
+	if (thread_count <= 1 ||
+		vcfh->compressor_type != NO_COMPRESSOR || rh->ref_cfh->compressor_type != NO_COMPRESSOR ||
+		((vcfh->state_flags | rh->ref_cfh->state_flags) & CFILE_CHILD_INHERITS_IO))
+	{
+		return OneHalfPassCorrecting(dcb, rh, rid, vcfh, vid);
+	}
+	ver_start = cfile_start_offset(vcfh);
+	range_len = ver_len / thread_count;
+
+	ranges = (OHPC_range *)calloc(thread_count, sizeof(OHPC_range));
+	threads = (pthread_t *)calloc(thread_count, sizeof(pthread_t));
+	if (ranges == NULL || threads == NULL)
+	{
+		free(ranges);
+		free(threads);
+		ERETURN(MEM_ERROR);
+	}
+	dcb_lprintf(1, "splitting version into %u ranges of ~%llu bytes\n", thread_count, (act_off_u64)range_len);
+
+	// handles are opened up front; cfile's child bookkeeping isn't thread safe.
+	for (x = 0; x < thread_count; x++)
+	{
+		ranges[x].rh = rh;
+		ranges[x].ver_range_start = x * range_len;
+		ranges[x].ver_range_end = (x + 1 == thread_count ? ver_len : (x + 1) * range_len);
+		if ((ranges[x].ver_cfh = copen_dup_cfh(vcfh)) == NULL ||
+			(ranges[x].ref_cfh = copen_dup_cfh(rh->ref_cfh)) == NULL ||
+			DCB_matches_init(&ranges[x].matches, 256, 0, ver_len))
+		{
+			thread_count = x + 1;
+			err = MEM_ERROR;
+			break;
+		}
+	}
+	for (x = 0; x < thread_count && err == 0; x++)
+	{
+		if (pthread_create(threads + x, NULL, OHPC_range_thread, ranges + x))
+		{
+			// run the remainder inline.
+			for (y = x; y < thread_count; y++)
+			{
+				OHPC_range_thread(ranges + y);
+			}
+			break;
+		}
+	}
+	while (x > 0 && err == 0)
+	{
+		x--;
+		pthread_join(threads[x], NULL);
+	}
+
+	vs = ver_start;
+	for (x = 0; x < thread_count; x++)
+	{
+		if (err == 0 && ranges[x].err)
+		{
+			err = ranges[x].err;
+		}
+		rh->good_matches += ranges[x].good_matches;
+		rh->bad_matches += ranges[x].bad_matches;
+		if (err == 0)
+		{
+			DCB_matches *dm = (DCB_matches *)ranges[x].matches.DCB;
+			for (y = 0, m = dm->buff; y < dm->buff_count; y++, m++)
+			{
+				if (m->ver_pos + m->len <= vs)
+				{
+					continue;
+				}
+				skip = (m->ver_pos < vs ? vs - m->ver_pos : 0);
+				if (vs < m->ver_pos)
+				{
+					DCB_add_add(dcb, vs, m->ver_pos - vs, vid);
+				}
+				DCB_add_copy(dcb, m->src_pos + skip, m->ver_pos + skip, m->len - skip, rid);
+				vs = m->ver_pos + m->len;
+			}
+		}
+		if (ranges[x].matches.DCB)
+		{
+			DCBufferFree(&ranges[x].matches);
+		}
+		if (ranges[x].ver_cfh)
+		{
+			cclose(ranges[x].ver_cfh);
+			free(ranges[x].ver_cfh);
+		}
+		if (ranges[x].ref_cfh)
+		{
+			cclose(ranges[x].ref_cfh);
+			free(ranges[x].ref_cfh);
+		}
+	}
+	if (err == 0 && vs != ver_start + ver_len)
+	{
+		DCB_add_add(dcb, vs, ver_start + ver_len - vs, vid);
+	}
+	free(ranges);
+	free(threads);
+	if (err)
+		ERETURN(err);
+	return 0;
+}
+
+/* build (or pull from index) the forward hash of the whole reference that MultiPassAlg's first pass
+   uses; data_len is how much version data it'll be matched against, and drives the sample rate. */
+signed int
+build_reference_hash(RefHash *rhash, cfile *ref_cfh, unsigned long max_hash_size, unsigned long sample_rate,
+					 unsigned int seed_len, unsigned long data_len, unsigned int thread_count, RefHashIndex *index)
+{
+	unsigned long hash_size;
+	int err;
+	hash_size = MAX(MIN_RHASH_SIZE, MIN(max_hash_size, cfile_len(ref_cfh)));
+	if (sample_rate == 0)
+		sample_rate = COMPUTE_SAMPLE_RATE(hash_size, data_len, seed_len);
+	dcb_lprintf(1, "using hash_size(%lu), sample_rate(%lu)\n",
+				hash_size, sample_rate);
+	err = (index ? RHash_index_load(index, rhash, ref_cfh, 0, cfile_len(ref_cfh), seed_len, sample_rate,
+									DEFAULT_RHASH_SAMPLING, RH_BUCKET_HASH, hash_size)
+				 : 0);
+	if (err < 0)
+		ERETURN(err);
+	if (err)
+	{
+		dcb_lprintf(1, "reusing the reference hash from the index\n");
+		return 0;
+	}
+	dcb_lprintf(1, "building hash array out of the reference file\n");
+	err = rh_bucket_hash_init(rhash, ref_cfh, seed_len, sample_rate, hash_size);
+	if (err)
+		ERETURN(err);
+	rhash->sampling = DEFAULT_RHASH_SAMPLING;
+	if (MIN(hash_size, cfile_len(ref_cfh) / sample_rate) >= RH_FILTER_MIN_ENTRIES &&
+		(err = RHash_init_filter(rhash, MIN(hash_size, cfile_len(ref_cfh) / sample_rate))))
+	{
+		free_RefHash(rhash);
+		ERETURN(err);
+	}
+	err = RHash_insert_block_parallel(rhash, ref_cfh, 0L, cfile_len(ref_cfh), thread_count);
+	if (err)
+		ERETURN(err);
+	if (index && RHash_index_store(index, rhash, 0, cfile_len(ref_cfh), RH_BUCKET_HASH, hash_size))
+		dcb_lprintf(0, "failed storing the reference hash in the index, continuing\n");
+	return 0;
+}
+
+/* read len bytes at start into buff. */
+static signed int
+stream_load(cfile *cfh, off_u64 start, unsigned char *buff, off_u64 len)
+{
+	if (start != cseek(cfh, start, CSEEK_FSTART))
+		return IO_ERROR;
+	if (len != cread(cfh, buff, len))
+		return EOF_ERROR;
+	return 0;
+}
+
+static int
+cdc_chunk_cmp(const void *a, const void *b)
+{
+	const cdc_chunk *x = (const cdc_chunk *)a, *y = (const cdc_chunk *)b;
+	if (x->fp != y->fp)
+		return (x->fp < y->fp ? -1 : 1);
+	return (x->offset < y->offset ? -1 : (x->offset > y->offset ? 1 : 0));
+}
+
+// first chunk sorting at or after (fp, offset), or NULL.
+static cdc_chunk *
+cdc_lower_bound(cdc_chunk *chunks, unsigned long count, unsigned long long fp, off_u64 offset)
+{
+	unsigned long lo = 0, hi = count, mid;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (chunks[mid].fp < fp || (chunks[mid].fp == fp && chunks[mid].offset < offset))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < count && chunks[lo].fp == fp ? chunks + lo : NULL);
+}
+
+/* how many bytes the version and reference agree on running forward from ver/ref, or backward
+   ending at them, up to max; read through rbuff/vbuff, CDC_MAX_CHUNK at a time. */
+static signed int
+cdc_extend(cfile *ver_cfh, off_u64 ver, cfile *ref_cfh, off_u64 ref, off_u64 max, int backward,
+		   unsigned char *vbuff, unsigned char *rbuff, off_u64 *len)
+{
+	unsigned long step, n;
+	int err;
+	for (*len = 0; *len < max; *len += n)
+	{
+		step = MIN(max - *len, CDC_MAX_CHUNK);
+		if (backward)
+		{
+			if ((err = stream_load(ver_cfh, ver - *len - step, vbuff, step)) != 0 ||
+				(err = stream_load(ref_cfh, ref - *len - step, rbuff, step)) != 0)
+				return err;
+			n = match_backward(vbuff + step, rbuff + step, step);
+		}
+		else
+		{
+			if ((err = stream_load(ver_cfh, ver + *len, vbuff, step)) != 0 ||
+				(err = stream_load(ref_cfh, ref + *len, rbuff, step)) != 0)
+				return err;
+			n = match_forward(vbuff, rbuff, step);
+		}
+		if (n < step)
+		{
+			*len += n;
+			break;
+		}
+	}
+	return 0;
+}
+
+/* chunk matches stop at chunk bounds; grow the copy over the matching bytes around it, back no
+   further than floor and forward no further than ceil in the version, and add it.  *floor is
+   moved to the end of what was added, and the reference range it came from goes in copied. */
+static signed int
+cdc_add_copy(CommandBuffer *buff, unsigned char ref_id, cfile *ref_cfh, cfile *ver_cfh, off_u64 src, off_u64 ver,
+			 off_u64 len, off_u64 *floor, off_u64 ceil, unsigned char *rbuff, unsigned char *vbuff, DCLoc *copied)
+{
+	off_u64 back, fwd;
+	int err;
+	if ((err = cdc_extend(ver_cfh, ver, ref_cfh, src, MIN(ver - *floor, src), 1, vbuff, rbuff, &back)) != 0 ||
+		(err = cdc_extend(ver_cfh, ver + len, ref_cfh, src + len,
+						  MIN(ceil - (ver + len), cfile_len(ref_cfh) - (src + len)), 0, vbuff, rbuff, &fwd)) != 0)
+		return err;
+	*floor = ver + len + fwd;
+	copied->offset = src - back;
+	copied->len = back + len + fwd;
+	return DCB_add_copy(buff, src - back, ver - back, back + len + fwd, ref_id);
+}
+
+/* content defined chunking pass: chunk both files, and copy every version chunk whose content
+   turns up among the reference's.  A chunk continuing the previous copy in the reference is
+   preferred, so unchanged runs collapse into a single copy; candidates are verified byte for
+   byte.  Whatever's left- edits, and the chunks around them- goes to the seed passes.  The
+   reference ranges copied from are returned in *copied (caller frees), in version order. */
+static signed int
+CDCPass(CommandBuffer *buff, cfile *ref_cfh, unsigned char ref_id, cfile *ver_cfh, DCLoc **copied,
+		unsigned long *copied_count)
+{
+	cdc_chunk *rc = NULL, *vc = NULL, *c;
+	unsigned long rcount = 0, vcount = 0, x, chunks = 0;
+	unsigned char *rbuff = NULL, *vbuff = NULL;
+	off_u64 copy_src = 0, copy_ver = 0, copy_len = 0, copy_floor = 0, matched = 0;
+	int err;
+
+	*copied = NULL;
+	*copied_count = 0;
+	if ((err = cdc_chunk_cfile(ref_cfh, &rc, &rcount)) != 0 ||
+		(err = cdc_chunk_cfile(ver_cfh, &vc, &vcount)) != 0)
+		goto cleanup;
+	dcb_lprintf(1, "chunked reference(%lu chunks), version(%lu chunks)\n", rcount, vcount);
+	qsort(rc, rcount, sizeof(cdc_chunk), cdc_chunk_cmp);
+	rbuff = (unsigned char *)malloc(CDC_MAX_CHUNK);
+	vbuff = (unsigned char *)malloc(CDC_MAX_CHUNK);
+	// every copy is at least a chunk, and chunks don't overlap.
+	*copied = (DCLoc *)malloc((vcount + 1) * sizeof(DCLoc));
+	if (rbuff == NULL || vbuff == NULL || *copied == NULL)
+	{
+		err = MEM_ERROR;
+		goto cleanup;
+	}
+	if ((err = DCB_llm_init_buff(buff, 128)) != 0)
+		goto cleanup;
+	for (x = 0; x < vcount && err == 0; x++)
+	{
+		c = NULL;
+		if (copy_len && copy_ver + copy_len == vc[x].offset)
+		{
+			c = cdc_lower_bound(rc, rcount, vc[x].fp, copy_src + copy_len);
+			if (c && c->offset != copy_src + copy_len)
+				c = NULL;
+		}
+		if (c == NULL && (c = cdc_lower_bound(rc, rcount, vc[x].fp, 0)) == NULL)
+			continue;
+		if (c->len != vc[x].len)
+			continue;
+		if ((err = stream_load(ver_cfh, vc[x].offset, vbuff, vc[x].len)) != 0 ||
+			(err = stream_load(ref_cfh, c->offset, rbuff, c->len)) != 0)
+			break;
+		if (memcmp(vbuff, rbuff, c->len) != 0)
+			continue;
+		matched += c->len;
+		chunks++;
+		if (copy_len && copy_ver + copy_len == vc[x].offset && copy_src + copy_len == c->offset)
+		{
+			copy_len += c->len;
+			continue;
+		}
+		if (copy_len)
+			err = cdc_add_copy(buff, ref_id, ref_cfh, ver_cfh, copy_src, copy_ver, copy_len, &copy_floor,
+							   vc[x].offset, rbuff, vbuff, (*copied) + (*copied_count)++);
+		copy_src = c->offset;
+		copy_ver = vc[x].offset;
+		copy_len = c->len;
+	}
+	if (err == 0 && copy_len)
+		err = cdc_add_copy(buff, ref_id, ref_cfh, ver_cfh, copy_src, copy_ver, copy_len, &copy_floor,
+						   cfile_len(ver_cfh), rbuff, vbuff, (*copied) + (*copied_count)++);
+	if (err == 0)
+		err = DCB_finalize(buff);
+	dcb_lprintf(1, "chunking pass matched %lu chunks (%llu bytes)\n", chunks, (act_off_u64)matched);
+
+cleanup:
+	free(rbuff);
+	free(vbuff);
+	free(rc);
+	free(vc);
+	if (err)
+	{
+		free(*copied);
+		*copied = NULL;
+		*copied_count = 0;
+		ERETURN(err);
+	}
+	return 0;
+}
+
+static int
+dcloc_offset_cmp(const void *a, const void *b)
+{
+	const DCLoc *x = (const DCLoc *)a, *y = (const DCLoc *)b;
+	return (x->offset < y->offset ? -1 : (x->offset > y->offset ? 1 : 0));
+}
+
+/* the forward hash for the pass after CDCPass; only the reference ranges nothing was copied from
+   are hashed.  On mostly unchanged input the gaps are edits of exactly those ranges, and skipping
+   the rest is most of the cost of the pass.  copied is sorted in place. */
+static signed int
+build_uncopied_reference_hash(RefHash *rhash, cfile *ref_cfh, unsigned long max_hash_size, unsigned long sample_rate,
+							  unsigned int seed_len, unsigned long data_len, DCLoc *copied, unsigned long copied_count)
+{
+	unsigned long hash_size, x;
+	off_u64 pos, uncopied = 0, ref_len = cfile_len(ref_cfh);
+	int err;
+	qsort(copied, copied_count, sizeof(DCLoc), dcloc_offset_cmp);
+	for (x = 0, pos = 0; x <= copied_count; x++)
+	{
+		if (x == copied_count || copied[x].offset > pos)
+			uncopied += (x == copied_count ? ref_len : copied[x].offset) - MIN(pos, ref_len);
+		if (x < copied_count)
+			pos = MAX(pos, copied[x].offset + copied[x].len);
+	}
+	hash_size = MAX(MIN_RHASH_SIZE, MIN(max_hash_size, uncopied));
+	if (sample_rate == 0)
+		sample_rate = COMPUTE_SAMPLE_RATE(hash_size, data_len, seed_len);
+	dcb_lprintf(1, "using hash_size(%lu), sample_rate(%lu)\n", hash_size, sample_rate);
+	dcb_lprintf(1, "building hash array out of the %llu uncopied bytes of the reference file\n",
+				(act_off_u64)uncopied);
+	if ((err = rh_bucket_hash_init(rhash, ref_cfh, seed_len, sample_rate, hash_size)) != 0)
+		ERETURN(err);
+	rhash->sampling = DEFAULT_RHASH_SAMPLING;
+	for (x = 0, pos = 0; x <= copied_count; x++)
+	{
+		if ((x == copied_count ? ref_len : copied[x].offset) >= pos + seed_len &&
+			(err = RHash_insert_block(rhash, ref_cfh, pos, x == copied_count ? ref_len : copied[x].offset)) != 0)
+		{
+			free_RefHash(rhash);
+			ERETURN(err);
+		}
+		if (x < copied_count)
+			pos = MAX(pos, copied[x].offset + copied[x].len);
+	}
+	return 0;
+}
+
+/* ref_hash, if given, is a prebuilt forward hash of the reference (see build_reference_hash) used
+   for the first pass when its seed_len matches.  It's only read, and isn't freed.  sample_rate, if
+   nonzero, is used for the forward hash; the reverse passes size theirs to the gaps. */
 signed int
 MultiPassAlg(CommandBuffer *buff, cfile *ref_cfh, unsigned char ref_id,
 			 cfile *ver_cfh, unsigned char ver_id,
-			 unsigned long max_hash_size, unsigned int seed_len)
+			 unsigned long max_hash_size, unsigned long first_sample_rate, unsigned int seed_len,
+			 unsigned int thread_count, RefHash *ref_hash)
 {
 	int err;
 	RefHash rhash;
+	unsigned char shared;
 	cfile ver_window;
 	memset(&ver_window, 0, sizeof(cfile));
 	unsigned long hash_size = 0, sample_rate = 1;
 	unsigned long gap_req;
 	unsigned long gap_total_len;
 	unsigned char first_run = 0; // first_run is used to control which hashing approach we use.
-	DCLoc dc;
+	DCLoc dc, *copied = NULL;
+	unsigned long copied_count = 0;
 	assert(buff->DCBtype & DCBUFFER_LLMATCHES_TYPE);
 	err = DCB_finalize(buff);
 	if (err)
 		ERETURN(err);
+	/* chunk matching first, unless a shared reference hash is already paid for.  Whatever it
+	   leaves still gets the forward pass, which only walks the gaps. */
+	first_run = (DCB_LLM_MATCH_COUNT((DCB_llm *)buff->DCB) == 0);
+	if (ref_hash == NULL && first_run &&
+		cfile_len(ref_cfh) >= MIN_CDC_PASS_LEN && cfile_len(ver_cfh) >= MIN_CDC_PASS_LEN)
+	{
+		err = CDCPass(buff, ref_cfh, ref_id, ver_cfh, &copied, &copied_count);
+		if (err)
+			ERETURN(err);
+	}
 
 	dcb_lprintf(1, "multipass, hash_size(%lu)\n", hash_size);
 	for (; seed_len >= 16; seed_len /= 2)
 	{
-		if (((DCB_llm *)buff->DCB)->main_head == NULL)
+		if (DCB_LLM_MATCH_COUNT((DCB_llm *)buff->DCB) == 0)
 		{
 			first_run = 1;
 		}
@@ -270,7 +808,7 @@ MultiPassAlg(CommandBuffer *buff, cfile *ref_cfh, unsigned char ref_id,
 		while (DCB_get_next_gap(buff, gap_req, &dc))
 		{
 			assert(dc.len <= buff->ver_size);
-			dcb_lprintf(2, "gap at %llu:%llu size %u\n", (act_off_u64)dc.offset, (act_off_u64)(dc.offset + dc.len), dc.len);
+			dcb_lprintf(2, "gap at %llu:%llu size %llu\n", (act_off_u64)dc.offset, (act_off_u64)(dc.offset + dc.len), (act_off_u64)dc.len);
 			gap_total_len += dc.len;
 		}
 		if (gap_total_len == 0)
@@ -282,31 +820,45 @@ MultiPassAlg(CommandBuffer *buff, cfile *ref_cfh, unsigned char ref_id,
 			continue;
 		}
 		DCBufferReset(buff);
-		if(first_run) {
-			hash_size = MAX(MIN_RHASH_SIZE, MIN(max_hash_size, cfile_len(ref_cfh)));
-        } else {
-			hash_size = max_hash_size;
-        }
-		sample_rate = COMPUTE_SAMPLE_RATE(hash_size, gap_total_len, seed_len);
-		dcb_lprintf(1, "using hash_size(%lu), sample_rate(%lu)\n",
-					hash_size, sample_rate);
+		shared = 0;
 
 		// if this is the first run, build hash directly from the reference file.  If it's not the first run,
 		// build a hash of the remaining version content, then walk the entire reference file finding matches.
 		// In theory, that reverse walk is less effected by hash collisions.  Pragmatic reality, this is
 		// probably better addressed via improving the hashing logic.
 		if(first_run) {
-			dcb_lprintf(1, "building hash array out of the reference file");
-			err = rh_bucket_hash_init(&rhash, ref_cfh, seed_len, sample_rate, hash_size);
-			if (err)
-				ERETURN(err);
-			err = RHash_insert_block(&rhash, ref_cfh, 0L, cfile_len(ref_cfh));
-			if (err)
-				ERETURN(err);
+			if (ref_hash && ref_hash->seed_len == seed_len) {
+				dcb_lprintf(1, "using the prebuilt reference hash\n");
+				rhash = *ref_hash;
+				rhash.ref_cfh = ref_cfh;
+				shared = 1;
+			} else {
+				if (copied_count)
+					err = build_uncopied_reference_hash(&rhash, ref_cfh, max_hash_size, first_sample_rate, seed_len,
+														gap_total_len, copied, copied_count);
+				else
+					err = build_reference_hash(&rhash, ref_cfh, max_hash_size, first_sample_rate, seed_len,
+											   gap_total_len, thread_count, NULL);
+				free(copied);
+				copied = NULL;
+				copied_count = 0;
+				if (err)
+					ERETURN(err);
+			}
 			first_run = 0;
 		} else {
+			hash_size = max_hash_size;
+			sample_rate = COMPUTE_SAMPLE_RATE(hash_size, gap_total_len, seed_len);
+			dcb_lprintf(1, "using hash_size(%lu), sample_rate(%lu)\n",
+						hash_size, sample_rate);
 			err = rh_rbucket_hash_init(&rhash, ref_cfh, seed_len, sample_rate, hash_size);
 			if (err) ERETURN(err);
+			rhash.sampling = DEFAULT_RHASH_SAMPLING;
+			if (MIN(hash_size, gap_total_len / sample_rate) >= RH_FILTER_MIN_ENTRIES &&
+				(err = RHash_init_filter(&rhash, MIN(hash_size, gap_total_len / sample_rate)))) {
+				free_RefHash(&rhash);
+				ERETURN(err);
+			}
 
 			dcb_lprintf(1, "building hash array from total_gap(%lu) of the version file\n",
 			            gap_total_len);
@@ -321,6 +873,8 @@ MultiPassAlg(CommandBuffer *buff, cfile *ref_cfh, unsigned char ref_id,
 			}
 			dcb_lprintf(1, "cleansing hash, to speed bsearch's\n");
 			RHash_cleanse(&rhash);
+			err = RHash_freeze(&rhash);
+			if (err) ERETURN(err);
 		}
 		print_RefHash_stats(&rhash);
 
@@ -328,15 +882,15 @@ MultiPassAlg(CommandBuffer *buff, cfile *ref_cfh, unsigned char ref_id,
 		DCBufferReset(buff);
 		while (DCB_get_next_gap(buff, gap_req, &dc))
 		{
-			dcb_lprintf(2, "handling gap %llu:%llu, size %u\n", (act_off_u64)dc.offset,
-						(act_off_u64)(dc.offset + dc.len), dc.len);
+			dcb_lprintf(2, "handling gap %llu:%llu, size %llu\n", (act_off_u64)dc.offset,
+						(act_off_u64)(dc.offset + dc.len), (act_off_u64)dc.len);
 			err = copen_child_cfh(&ver_window, ver_cfh, dc.offset, dc.len + dc.offset, NO_COMPRESSOR, CFILE_RONLY);
 			if (err)
 				ERETURN(err);
 			err = DCB_llm_init_buff(buff, 128);
 			if (err)
 				ERETURN(err);
-			err = OneHalfPassCorrecting(buff, &rhash, ref_id, &ver_window, ver_id);
+			err = ParallelOneHalfPassCorrecting(buff, &rhash, ref_id, &ver_window, ver_id, thread_count);
 			if (err)
 				ERETURN(err);
 			err = DCB_finalize(buff);
@@ -344,12 +898,222 @@ MultiPassAlg(CommandBuffer *buff, cfile *ref_cfh, unsigned char ref_id,
 				ERETURN(err);
 			cclose(&ver_window);
 		}
-
+		print_RefHash_match_stats(&rhash);
 
 #ifdef DEBUG_DCBUFFER
 		assert(DCB_test_llm_main(buff));
 #endif
-		free_RefHash(&rhash);
+		if (!shared)
+			free_RefHash(&rhash);
+	}
+	free(copied);
+	return 0;
+}
+
+/* bounded memory differencing.  The version is walked in segments; each is MultiPass'd against
+   a window_len slice of the reference, placed wherever the previous segment's copies were coming
+   from, and the result is pushed into buffer (usually a DCB_stream) before the next segment is
+   looked at.  Both are held in memory, but only one segment and one window (and its hash) are
+   ever alive, so memory stays near mem_budget regardless of input size; matches outside the
+   window are missed.  ref_id is the src copies are read from, ver_id the src adds are. */
+signed int
+StreamingAlg(CommandBuffer *buffer, cfile *ref_cfh, unsigned char ref_id,
+			 cfile *ver_cfh, unsigned char ver_id,
+			 unsigned long window_len, unsigned long mem_budget, unsigned int seed_len)
+{
+	CommandBuffer seg;
+	cfile ref_window, ver_segment;
+	DCommand dc;
+	EDCB_SRC_ID seg_add_id, seg_copy_id;
+	off_u64 ref_len = cfile_len(ref_cfh), ver_len = cfile_len(ver_cfh);
+	off_u64 vs, len, rs, loaded_rs, seg_len, win_len;
+	off_s64 drift = 0, start;
+	unsigned char *ref_buff = NULL, *ver_buff = NULL;
+	unsigned long hash_size;
+	int err = 0;
+
+	// half the budget to the window, a quarter to its hash; the rest covers a segment and its matches.
+	if (window_len == 0 || window_len > mem_budget / 2)
+		window_len = mem_budget / 2;
+	win_len = MIN(window_len, ref_len);
+	hash_size = MAX(MIN_RHASH_SIZE, (mem_budget / 4) / STREAM_HASH_ENTRY_BYTES);
+	// segments well under the window leave it room to follow the matches.
+	seg_len = MAX(MIN_STREAM_SEGMENT_LEN, MIN(mem_budget / 16, window_len / 4));
+	seg_len = MIN(seg_len, MAX(ver_len, 1));
+	dcb_lprintf(1, "streaming, window(%llu), segment(%llu), hash_size(%lu)\n", (act_off_u64)win_len,
+				(act_off_u64)seg_len, hash_size);
+	if ((win_len && (ref_buff = (unsigned char *)malloc(win_len)) == NULL) ||
+		(ver_buff = (unsigned char *)malloc(seg_len)) == NULL)
+	{
+		free(ref_buff);
+		ERETURN(MEM_ERROR);
+	}
+	loaded_rs = ref_len;
+
+	for (vs = 0; vs < ver_len && err == 0; vs += len)
+	{
+		len = MIN(seg_len, ver_len - vs);
+		if (win_len < seed_len)
+		{
+			err = DCB_add_add(buffer, vs, len, ver_id);
+			continue;
+		}
+		// center the window on where this segment's data likely lives.
+		start = (off_s64)(vs + len / 2) + drift - (off_s64)(win_len / 2);
+		if (start < 0)
+			start = 0;
+		rs = MIN((off_u64)start, ref_len - win_len);
+		dcb_lprintf(1, "segment %llu:%llu against reference window %llu:%llu\n", (act_off_u64)vs,
+					(act_off_u64)(vs + len), (act_off_u64)rs, (act_off_u64)(rs + win_len));
+		if (rs != loaded_rs)
+		{
+			if ((err = stream_load(ref_cfh, rs, ref_buff, win_len)) != 0)
+				break;
+			loaded_rs = rs;
+		}
+		if ((err = stream_load(ver_cfh, vs, ver_buff, len)) != 0)
+			break;
+
+		memset(&ref_window, 0, sizeof(cfile));
+		memset(&ver_segment, 0, sizeof(cfile));
+		if ((err = copen_mem(&ref_window, ref_buff, win_len, NO_COMPRESSOR, CFILE_RONLY)) != 0)
+			break;
+		if ((err = copen_mem(&ver_segment, ver_buff, len, NO_COMPRESSOR, CFILE_RONLY)) != 0)
+		{
+			cclose(&ref_window);
+			break;
+		}
+		if ((err = DCB_llm_init(&seg, 4, win_len, len)) != 0)
+		{
+			cclose(&ver_segment);
+			cclose(&ref_window);
+			break;
+		}
+		seg_add_id = DCB_REGISTER_ADD_SRC(&seg, &ver_segment, NULL, 0);
+		seg_copy_id = DCB_REGISTER_COPY_SRC(&seg, &ref_window, NULL, 0);
+		if (seg_add_id < 0 || seg_copy_id < 0)
+			err = MEM_ERROR;
+		else if ((err = MultiPassAlg(&seg, &ref_window, seg_add_id, &ver_segment, seg_copy_id, hash_size, 0, seed_len, 1,
+									 NULL)) == 0)
+			err = DCB_finalize(&seg);
+
+		// translate the segment's commands back out to full file offsets.
+		DCBufferReset(&seg);
+		while (err == 0 && DCB_commands_remain(&seg))
+		{
+			DCB_get_next_command(&seg, &dc);
+			if (dc.data.len == 0)
+			{
+				DCBufferIncr(&seg);
+				continue;
+			}
+			if (dc.type == DC_COPY)
+			{
+				err = DCB_add_copy(buffer, rs + dc.data.src_pos, vs + dc.data.ver_pos, dc.data.len, ref_id);
+				drift = (off_s64)(rs + dc.data.src_pos) - (off_s64)(vs + dc.data.ver_pos);
+			}
+			else
+			{
+				err = DCB_add_add(buffer, vs + dc.data.src_pos, dc.data.len, ver_id);
+			}
+		}
+		DCBufferFree(&seg);
+		cclose(&ver_segment);
+		cclose(&ref_window);
 	}
+	free(ref_buff);
+	free(ver_buff);
+	if (err)
+		ERETURN(err);
+	return 0;
+}
+
+/* longest match for v among the reference's suffixes, bsdiff style: binary search for where v
+   would sort, and take the better of its neighbours.  *pos gets where it starts. */
+static off_u64
+suffix_longest_match(const int *sa, const unsigned char *ref, off_u64 ref_len, const unsigned char *v,
+					 off_u64 v_len, off_u64 *pos)
+{
+	off_u64 lo = 0, hi = ref_len - 1, mid, a, b;
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (memcmp(ref + sa[mid], v, MIN(ref_len - sa[mid], v_len)) < 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	a = match_forward(v, ref + sa[lo], MIN(ref_len - sa[lo], v_len));
+	b = match_forward(v, ref + sa[hi], MIN(ref_len - sa[hi], v_len));
+	*pos = (a >= b ? sa[lo] : sa[hi]);
+	return MAX(a, b);
+}
+
+/* exhaustive matching against a suffix array of the reference.  At each version offset the
+   longest match anywhere in the reference is taken if it's at least min_match long, else the
+   offset is left for an add; no sampling, so short and unaligned matches the hash skips over are
+   found.  Both files and the array are held in memory- see SUFFIX_ALG_MEMORY- and the reference
+   is limited to SUFFIX_MAX_LEN.  buff must be a DCB_llm. */
+signed int
+SuffixAlg(CommandBuffer *buff, cfile *ref_cfh, unsigned char ref_id,
+		  cfile *ver_cfh, unsigned char ver_id, unsigned int min_match)
+{
+	off_u64 ref_len = cfile_len(ref_cfh), ver_len = cfile_len(ver_cfh);
+	off_u64 vs, v, len, pos, back;
+	unsigned char *ref = NULL, *ver = NULL;
+	int *sa = NULL;
+	int err;
+	assert(buff->DCBtype & DCBUFFER_LLMATCHES_TYPE);
+	if (ref_len > SUFFIX_MAX_LEN)
+		ERETURN(UNSUPPORTED_OPT);
+	min_match = MAX(min_match, 1);
+	if ((err = DCB_finalize(buff)) != 0 || (err = DCB_llm_init_buff(buff, 128)) != 0)
+		ERETURN(err);
+	if (ref_len < min_match || ver_len < min_match)
+		return DCB_finalize(buff);
+
+	dcb_lprintf(1, "suffix matching, reference(%llu), version(%llu)\n", (act_off_u64)ref_len, (act_off_u64)ver_len);
+	ref = (unsigned char *)malloc(ref_len);
+	ver = (unsigned char *)malloc(ver_len);
+	sa = (int *)malloc(ref_len * sizeof(int));
+	if (ref == NULL || ver == NULL || sa == NULL)
+	{
+		err = MEM_ERROR;
+		goto cleanup;
+	}
+	if ((err = stream_load(ref_cfh, 0, ref, ref_len)) != 0 || (err = stream_load(ver_cfh, 0, ver, ver_len)) != 0)
+		goto cleanup;
+	if ((err = suffix_array_build(ref, sa, ref_len)) != 0)
+		goto cleanup;
+	dcb_lprintf(1, "built suffix array, matching\n");
+
+	for (vs = v = 0; v + min_match <= ver_len && err == 0;)
+	{
+		len = suffix_longest_match(sa, ref, ref_len, ver + v, ver_len - v, &pos);
+		if (len < min_match)
+		{
+			v++;
+			continue;
+		}
+		// a shorter match just before this one may have been passed over.
+		back = match_backward(ver + v, ref + pos, MIN(v - vs, pos));
+		if (v - back > vs)
+			err = DCB_add_add(buff, vs, v - back - vs, ver_id);
+		if (err == 0)
+			err = DCB_add_copy(buff, pos - back, v - back, len + back, ref_id);
+		v += len;
+		vs = v;
+	}
+	if (err == 0 && vs < ver_len)
+		err = DCB_add_add(buff, vs, ver_len - vs, ver_id);
+	if (err == 0)
+		err = DCB_finalize(buff);
+
+cleanup:
+	free(sa);
+	free(ref);
+	free(ver);
+	if (err)
+		ERETURN(err);
 	return 0;
 }
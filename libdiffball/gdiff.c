@@ -54,87 +54,84 @@ check_gdiff5_magic(cfile *patchf)
 }
 
 signed int
-gdiffEncodeDCBuffer(CommandBuffer *buffer,
-					unsigned int offset_type, cfile *out_cfh)
+gdiffStreamStart(gdiff_stream *gs, unsigned int offset_type, cfile *out_cfh)
 {
-	unsigned char clen;
-	unsigned long fh_pos = 0;
-	signed long s_off = 0;
-	unsigned long u_off = 0;
-	off_u32 delta_pos = 0, dc_pos = 0;
-	unsigned int lb = 0, ob = 0;
-	unsigned char off_is_sbytes = 0;
-	unsigned char out_buff[5];
-	DCommand dc;
-
+	unsigned char out_buff[GDIFF_MAGIC_LEN + GDIFF_VER_LEN];
+	gs->out_cfh = out_cfh;
+	gs->dc_pos = 0;
 	if (offset_type == ENCODING_OFFSET_DC_POS)
 	{
-		off_is_sbytes = 1;
+		gs->off_is_sbytes = 1;
 	}
-	else
+	else if (offset_type == ENCODING_OFFSET_START)
 	{
-		off_is_sbytes = 0;
+		gs->off_is_sbytes = 0;
 	}
-	writeUBytesBE(out_buff, GDIFF_MAGIC, GDIFF_MAGIC_LEN);
-	cwrite(out_cfh, out_buff, GDIFF_MAGIC_LEN);
-	if (offset_type == ENCODING_OFFSET_START)
-		writeUBytesBE(out_buff, GDIFF_VER4_MAGIC, GDIFF_VER_LEN);
-	else if (offset_type == ENCODING_OFFSET_DC_POS)
-		writeUBytesBE(out_buff, GDIFF_VER5_MAGIC, GDIFF_VER_LEN);
 	else
 	{
 		return PATCH_CORRUPT_ERROR;
 	}
-	cwrite(out_cfh, out_buff, GDIFF_VER_LEN);
-	DCBufferReset(buffer);
-	while (DCB_commands_remain(buffer))
+	writeUBytesBE(out_buff, GDIFF_MAGIC, GDIFF_MAGIC_LEN);
+	writeUBytesBE(out_buff + GDIFF_MAGIC_LEN, gs->off_is_sbytes ? GDIFF_VER5_MAGIC : GDIFF_VER4_MAGIC,
+				  GDIFF_VER_LEN);
+	if (cwrite(out_cfh, out_buff, GDIFF_MAGIC_LEN + GDIFF_VER_LEN) != GDIFF_MAGIC_LEN + GDIFF_VER_LEN)
 	{
-		DCB_get_next_command(buffer, &dc);
-		if (dc.data.len == 0)
-		{
-			DCBufferIncr(buffer);
-			continue;
-		}
+		return IO_ERROR;
+	}
+	return 0;
+}
+
+/* write a single command; matches dcb_stream_emit_func so it can be handed to a DCB_stream. */
+signed int
+gdiffStreamCommand(void *data, DCommand *dcp)
+{
+	gdiff_stream *gs = (gdiff_stream *)data;
+	cfile *out_cfh = gs->out_cfh;
+	unsigned char clen;
+	signed long s_off = 0;
+	unsigned long u_off = 0;
+	off_u64 remain;
+	unsigned int lb = 0, ob = 0;
+	unsigned char out_buff[13];
+	DCommand dc = *dcp;
+
+	// lengths are at most 4 bytes; anything longer goes out in pieces.
+	for (remain = dc.data.len; remain; remain -= dc.data.len, dc.data.src_pos += dc.data.len)
+	{
+		dc.data.len = MIN(remain, GDIFF_MAX_LEN);
 		if (dc.type == DC_ADD)
 		{
-			u_off = dc.data.len;
 			if (dc.data.len <= 246)
 			{
 				out_buff[0] = dc.data.len;
-				cwrite(out_cfh, out_buff, 1);
-				delta_pos += 1;
+				clen = 1;
 			}
 			else if (dc.data.len <= 0xffff)
 			{
 				out_buff[0] = 247;
 				writeUBytesBE(out_buff + 1, dc.data.len, 2);
-				cwrite(out_cfh, out_buff, 3);
-				delta_pos += 3;
+				clen = 3;
 			}
-			else if (dc.data.len <= 0xffffffff)
+			else
 			{
 				out_buff[0] = 248;
 				writeUBytesBE(out_buff + 1, dc.data.len, 4);
-				cwrite(out_cfh, out_buff, 5);
-				delta_pos += 5;
+				clen = 5;
 			}
-			else
+			if (cwrite(out_cfh, out_buff, clen) != clen)
 			{
-				return FORMAT_ERROR;
+				return IO_ERROR;
 			}
-			if (dc.data.len != copyDCB_add_src(buffer, &dc, out_cfh))
+			if (dc.data.len != copyDCB_add_src(dc.dcb_ptr, &dc, out_cfh))
 			{
 				return EOF_ERROR;
 			}
-
-			delta_pos += dc.data.len;
-			fh_pos += dc.data.len;
 		}
 		else
 		{
-			if (off_is_sbytes)
+			if (gs->off_is_sbytes)
 			{
-				s_off = (signed long)dc.data.src_pos - (signed long)dc_pos;
+				s_off = (signed long)dc.data.src_pos - (signed long)gs->dc_pos;
 				u_off = labs(s_off);
 				ob = signedBytesNeeded(s_off);
 			}
@@ -181,10 +178,12 @@ gdiffEncodeDCBuffer(CommandBuffer *buffer,
 			}
 			else
 			{
+				// the only long offset copy takes an int length.
 				ob = LONG_BYTE_COUNT;
+				lb = INT_BYTE_COUNT;
 				out_buff[0] = 255;
 			}
-			if (off_is_sbytes)
+			if (gs->off_is_sbytes)
 			{
 				writeSBytesBE(out_buff + clen, s_off, ob);
 			}
@@ -199,24 +198,61 @@ gdiffEncodeDCBuffer(CommandBuffer *buffer,
 			{
 				return IO_ERROR;
 			}
-			fh_pos += dc.data.len;
-			delta_pos += 1 + ob + lb;
-			dc_pos += s_off;
+			gs->dc_pos += s_off;
 		}
 	}
+	return 0;
+}
+
+signed int
+gdiffStreamFinish(gdiff_stream *gs)
+{
+	unsigned char out_buff[1];
 	out_buff[0] = 0;
-	cwrite(out_cfh, out_buff, 1);
-	//ahem.  better error handling/returning needed. in time, in time...
+	if (cwrite(gs->out_cfh, out_buff, 1) != 1)
+	{
+		return IO_ERROR;
+	}
 	return 0;
 }
 
+signed int
+gdiffEncodeDCBuffer(CommandBuffer *buffer,
+					unsigned int offset_type, cfile *out_cfh)
+{
+	gdiff_stream gs;
+	DCommand dc;
+	int err;
+
+	if ((err = gdiffStreamStart(&gs, offset_type, out_cfh)) != 0)
+	{
+		return err;
+	}
+	DCBufferReset(buffer);
+	while (DCB_commands_remain(buffer))
+	{
+		DCB_get_next_command(buffer, &dc);
+		if (dc.data.len == 0)
+		{
+			DCBufferIncr(buffer);
+			continue;
+		}
+		if ((err = gdiffStreamCommand(&gs, &dc)) != 0)
+		{
+			return err;
+		}
+	}
+	return gdiffStreamFinish(&gs);
+}
+
 signed int
 gdiffReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbuff,
 					   unsigned int offset_type)
 {
 	const unsigned int buff_size = 13;
 	unsigned char buff[buff_size];
-	off_u32 len, dc_pos = 0;
+	off_u32 len;
+	off_u64 dc_pos = 0;
 	off_u64 ver_pos = 0;
 	off_u64 u_off = 0;
 	off_s64 s_off = 0;
@@ -1,9 +1,15 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // Copyright (C) 2003-2015 Brian Harring <ferringb@gmail.com>
 #include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
 #include <diffball/defs.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <diffball/adler32.h>
 #include <diffball/defs.h>
 #include <diffball/hash.h>
@@ -24,6 +30,9 @@ static signed int
 common_rh_bucket_hash_init(RefHash *rhash, cfile *ref_cfh, unsigned int seed_len, unsigned int sample_rate, unsigned long hr_size, unsigned int type);
 static signed int internal_loop_block(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end, hash_insert_func);
 
+//c standards for inline are stupid.
+extern unsigned int RHash_filter_test(rh_filter *filter, unsigned long chksum);
+
 #define RH_BUCKET_NEED_RESIZE(x) \
 	(((x) & ((x)-1)) == 0)
 
@@ -44,7 +53,7 @@ RHash_cleanse(RefHash *rh)
 }
 
 static inline signed int
-RH_bucket_find_chksum_insert_pos(unsigned short chksum, unsigned short array[],
+RH_bucket_find_chksum_insert_pos(rh_bucket_tag chksum, rh_bucket_tag array[],
 								 unsigned short count)
 {
 	int low = 0, high, mid;
@@ -81,7 +90,7 @@ RH_bucket_find_chksum_insert_pos(unsigned short chksum, unsigned short array[],
 
 /* ripped straight out of K&R C manual.  great book btw. */
 static inline signed int
-RH_bucket_find_chksum(unsigned short chksum, unsigned short array[],
+RH_bucket_find_chksum(rh_bucket_tag chksum, rh_bucket_tag array[],
 					  unsigned short count)
 {
 	int low, high, mid;
@@ -122,7 +131,7 @@ base_rh_bucket_lookup(RefHash *rhash, ADLER32_SEED_CTX *ads)
 	{
 		return 0;
 	}
-	chksum = ((chksum >> 16) & 0xffff);
+	chksum = RH_BUCKET_TAG(chksum);
 	pos = RH_bucket_find_chksum(chksum, hash->chksum[index], hash->depth[index]);
 	if (pos >= 0)
 	{
@@ -132,10 +141,60 @@ base_rh_bucket_lookup(RefHash *rhash, ADLER32_SEED_CTX *ads)
 	return 0;
 }
 
+static void
+base_rh_bucket_prefetch(RefHash *rhash, unsigned long chksum)
+{
+	bucket *hash = (bucket *)rhash->hash;
+	__builtin_prefetch(hash->depth + (chksum & RHASH_INDEX_MASK));
+	__builtin_prefetch(hash->chksum + (chksum & RHASH_INDEX_MASK));
+}
+
+static void
+rh_filter_add(rh_filter *filter, unsigned long chksum)
+{
+	unsigned long long *block, h;
+	unsigned int x;
+	block = RH_FILTER_BLOCK(filter, chksum);
+	h = RH_FILTER_BIT_HASH(chksum);
+	// parallel builds share the filter.
+	for (x = 0; x < RH_FILTER_PROBES; x++, h <<= 9)
+		__atomic_fetch_or(block + (h >> 61), 1ULL << ((h >> 55) & 63), __ATOMIC_RELAXED);
+}
+
+/* attach a prefilter sized for entries; must follow the hash init, and precede the inserts. */
+signed int
+RHash_init_filter(RefHash *rhash, unsigned long entries)
+{
+	rh_filter *filter;
+	unsigned int bits;
+	unsigned long blocks;
+	blocks = (entries * RH_FILTER_BITS_PER_ENTRY) / (RH_FILTER_BLOCK_WORDS * 64) + 1;
+	bits = MAX(unsignedBitsNeeded(blocks - 1), 1);
+	if ((filter = (rh_filter *)malloc(sizeof(rh_filter))) == NULL)
+		return MEM_ERROR;
+	filter->blocks = 1UL << bits;
+	filter->shift = 64 - bits;
+	filter->bits = (unsigned long long *)calloc(filter->blocks * RH_FILTER_BLOCK_WORDS, sizeof(unsigned long long));
+	if (filter->bits == NULL)
+	{
+		free(filter);
+		return MEM_ERROR;
+	}
+	rhash->filter = filter;
+	dcb_lprintf(2, "hash filter: %lu bytes\n", filter->blocks * RH_FILTER_BLOCK_WORDS * sizeof(unsigned long long));
+	return 0;
+}
+
 signed int
 free_RefHash(RefHash *rhash)
 {
 	dcb_lprintf(2, "free_RefHash\n");
+	if (rhash->filter)
+	{
+		free(rhash->filter->bits);
+		free(rhash->filter);
+		rhash->filter = NULL;
+	}
 	if (rhash->free_hash)
 		rhash->free_hash(rhash);
 	else if (rhash->hash)
@@ -178,8 +237,10 @@ void common_init_RefHash(RefHash *rhash, cfile *ref_cfh, unsigned int seed_len,
 	rhash->seed_len = seed_len;
 	assert(seed_len > 0);
 	rhash->sample_rate = sample_rate;
+	rhash->sampling = RH_SAMPLE_STRIDE;
 	rhash->ref_cfh = ref_cfh;
 	rhash->inserts = rhash->duplicates = 0;
+	rhash->good_matches = rhash->bad_matches = 0;
 	rhash->hash = NULL;
 	rhash->type = type;
 	rhash->hr_size = 0;
@@ -187,6 +248,8 @@ void common_init_RefHash(RefHash *rhash, cfile *ref_cfh, unsigned int seed_len,
 	rhash->insert_match = NULL;
 	rhash->free_hash = fhf;
 	rhash->lookup_offset = hlof;
+	rhash->prefetch = NULL;
+	rhash->filter = NULL;
 	rhash->cleanse_hash = NULL;
 }
 
@@ -219,13 +282,14 @@ common_rh_bucket_hash_init(RefHash *rhash, cfile *ref_cfh, unsigned int seed_len
 	rh = (bucket *)malloc(sizeof(bucket));
 	if (rh == NULL)
 		return MEM_ERROR;
-	rh->max_depth = DEFAULT_RHASH_BUCKET_SIZE;
+	// depth is tracked in an unsigned char; don't let it wrap.
+	rh->max_depth = MIN(DEFAULT_RHASH_BUCKET_SIZE, UCHAR_MAX);
 	if ((rh->depth = (unsigned char *)calloc(sizeof(unsigned char), rhash->hr_size)) == NULL)
 	{
 		free(rh);
 		return MEM_ERROR;
 	}
-	else if ((rh->chksum = (unsigned short **)calloc(sizeof(unsigned short *), rhash->hr_size)) == NULL)
+	else if ((rh->chksum = (rh_bucket_tag **)calloc(sizeof(rh_bucket_tag *), rhash->hr_size)) == NULL)
 	{
 		free(rh->depth);
 		free(rh);
@@ -239,6 +303,7 @@ common_rh_bucket_hash_init(RefHash *rhash, cfile *ref_cfh, unsigned int seed_len
 		return MEM_ERROR;
 	}
 	rhash->hash = (void *)rh;
+	rhash->prefetch = base_rh_bucket_prefetch;
 	if (type == RH_RBUCKET_HASH)
 	{
 		rhash->cleanse_hash = rh_rbucket_cleanse;
@@ -254,7 +319,7 @@ RH_bucket_resize(bucket *hash, unsigned long index, unsigned short size)
 	assert(RH_BUCKET_NEED_RESIZE(hash->depth[index]));
 	if (hash->depth[index] == 0)
 	{
-		if ((hash->chksum[index] = (unsigned short *)malloc(size * sizeof(unsigned short))) == NULL)
+		if ((hash->chksum[index] = (rh_bucket_tag *)malloc(size * sizeof(rh_bucket_tag))) == NULL)
 			return MEM_ERROR;
 		if ((hash->offset[index] = (off_u64 *)malloc(size * sizeof(off_u64))) == NULL)
 		{
@@ -263,7 +328,7 @@ RH_bucket_resize(bucket *hash, unsigned long index, unsigned short size)
 		}
 		return 0;
 	}
-	if ((hash->chksum[index] = (unsigned short *)realloc(hash->chksum[index], size * sizeof(unsigned short))) == NULL)
+	if ((hash->chksum[index] = (rh_bucket_tag *)realloc(hash->chksum[index], size * sizeof(rh_bucket_tag))) == NULL)
 		return MEM_ERROR;
 	else if ((hash->offset[index] = (off_u64 *)realloc(hash->offset[index], size * sizeof(off_u64))) == NULL)
 		return MEM_ERROR;
@@ -279,7 +344,7 @@ base_rh_bucket_hash_insert(RefHash *rhash, ADLER32_SEED_CTX *ads, off_u64 offset
 	hash = (bucket *)rhash->hash;
 	chksum = get_checksum(ads);
 	index = (chksum & RHASH_INDEX_MASK);
-	chksum = ((chksum >> 16) & 0xffff);
+	chksum = RH_BUCKET_TAG(chksum);
 	if (!hash->depth[index])
 	{
 		if (RH_bucket_resize(hash, index, RH_BUCKET_MIN_ALLOC))
@@ -328,7 +393,7 @@ base_rh_bucket_hash_insert(RefHash *rhash, ADLER32_SEED_CTX *ads, off_u64 offset
 			else
 			{
 				/* shift low + 1 element to the right */
-				memmove(hash->chksum[index] + low + 1, hash->chksum[index] + low, (hash->depth[index] - low) * sizeof(unsigned short));
+				memmove(hash->chksum[index] + low + 1, hash->chksum[index] + low, (hash->depth[index] - low) * sizeof(rh_bucket_tag));
 				hash->chksum[index][low] = chksum;
 				if (rhash->type & RH_BUCKET_HASH)
 				{
@@ -351,6 +416,742 @@ base_rh_bucket_hash_insert(RefHash *rhash, ADLER32_SEED_CTX *ads, off_u64 offset
 	return FAILED_HASH_INSERT;
 }
 
+#define RH_FLAT_INDEX(hash, chksum) \
+	((unsigned long)(((unsigned long long)(chksum) * 0x9e3779b97f4a7c15ULL) >> (64 - (hash)->bits)))
+#define RH_FLAT_TAG(chksum) ((unsigned long long)(chksum) & ((1ULL << RH_FLAT_TAG_BITS) - 1))
+#define RH_FLAT_ENT(tag, offset) \
+	(RH_FLAT_USED | ((unsigned long long)(tag) << RH_FLAT_OFFSET_BITS) | (unsigned long long)(offset))
+#define RH_FLAT_ENT_TAG(ent) (((ent) >> RH_FLAT_OFFSET_BITS) & ((1ULL << RH_FLAT_TAG_BITS) - 1))
+#define RH_FLAT_ENT_OFFSET(ent) ((off_u64)((ent) & RH_FLAT_MAX_OFFSET))
+
+// slot holding chksum's tag, or the empty slot that ends its probe chain.
+static inline unsigned long
+rh_flat_hash_probe(flat_hash *hash, unsigned long chksum)
+{
+	unsigned long long tag = RH_FLAT_TAG(chksum), ent;
+	unsigned long index = RH_FLAT_INDEX(hash, chksum);
+	while ((ent = hash->table[index]) != 0)
+	{
+		if (RH_FLAT_ENT_TAG(ent) == tag)
+			break;
+		index = (index + 1) & hash->mask;
+	}
+	return index;
+}
+
+static signed int
+rh_flat_hash_insert_chksum(flat_hash *hash, unsigned long chksum, off_u64 offset)
+{
+	unsigned long index;
+	if (hash->fill >= hash->max_fill)
+		return FAILED_HASH_INSERT;
+	index = rh_flat_hash_probe(hash, chksum);
+	if (hash->table[index] != 0)
+		return FAILED_HASH_INSERT;
+	hash->table[index] = RH_FLAT_ENT(RH_FLAT_TAG(chksum), offset);
+	if (++hash->fill == hash->max_fill)
+		return SUCCESSFULL_HASH_INSERT_NOW_IS_FULL;
+	return SUCCESSFULL_HASH_INSERT;
+}
+
+static signed int
+rh_flat_hash_insert(RefHash *rhash, ADLER32_SEED_CTX *ads, off_u64 offset)
+{
+	return rh_flat_hash_insert_chksum((flat_hash *)rhash->hash, get_checksum(ads), offset);
+}
+
+static off_u64
+rh_flat_hash_lookup(RefHash *rhash, ADLER32_SEED_CTX *ads)
+{
+	flat_hash *hash = (flat_hash *)rhash->hash;
+	return RH_FLAT_ENT_OFFSET(hash->table[rh_flat_hash_probe(hash, get_checksum(ads))]);
+}
+
+// unmap something from rh_flat_hash_alloc or rh_index_map.
+static void
+rh_munmap(void *p, size_t len)
+{
+	size_t delta = (size_t)p % sysconf(_SC_PAGESIZE);
+	munmap((unsigned char *)p - delta, len + delta);
+}
+
+static void
+rh_flat_hash_prefetch(RefHash *rhash, unsigned long chksum)
+{
+	flat_hash *hash = (flat_hash *)rhash->hash;
+	__builtin_prefetch(hash->table + RH_FLAT_INDEX(hash, chksum));
+}
+
+static void
+rh_flat_table_free(flat_hash *hash)
+{
+	if (hash->mmapped)
+		rh_munmap(hash->table, hash->alloc_len);
+	else
+		free(hash->table);
+}
+
+static void
+rh_flat_hash_free(RefHash *rhash)
+{
+	flat_hash *hash = (flat_hash *)rhash->hash;
+	rh_flat_table_free(hash);
+	free(hash);
+}
+
+/* grab a zeroed table.  If huge pages are requested, try explicit hugetlb pages first, then fall
+   back to a normal mapping advised for transparent huge pages. */
+static signed int
+rh_flat_hash_alloc(flat_hash *hash, size_t len, unsigned int huge_pages)
+{
+	void *table;
+	hash->mmapped = 0;
+	if (huge_pages && len >= RH_HUGE_PAGE_SIZE)
+	{
+		len = (len + RH_HUGE_PAGE_SIZE - 1) & ~((size_t)RH_HUGE_PAGE_SIZE - 1);
+		table = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		table = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+		if (table == MAP_FAILED)
+		{
+			dcb_lprintf(2, "hugetlb pages unavailable, falling back to transparent huge pages\n");
+			table = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+			if (table != MAP_FAILED)
+				madvise(table, len, MADV_HUGEPAGE);
+#endif
+		}
+		if (table != MAP_FAILED)
+		{
+			hash->table = (unsigned long long *)table;
+			hash->alloc_len = len;
+			hash->mmapped = 1;
+			return 0;
+		}
+	}
+	if ((hash->table = (unsigned long long *)calloc(1, len)) == NULL)
+		return MEM_ERROR;
+	hash->alloc_len = len;
+	return 0;
+}
+
+// set up an empty table with room for entries under the load cap.
+static signed int
+rh_flat_table_init(flat_hash *hash, unsigned long entries, unsigned int huge_pages)
+{
+	unsigned int bits;
+	for (bits = 16; RH_FLAT_MAX_LOAD(1UL << bits) < entries; bits++)
+		;
+	hash->bits = bits;
+	hash->mask = (1UL << bits) - 1;
+	hash->fill = 0;
+	hash->max_fill = RH_FLAT_MAX_LOAD(1UL << bits);
+	return rh_flat_hash_alloc(hash, sizeof(unsigned long long) << bits, huge_pages);
+}
+
+signed int
+rh_flat_hash_init(RefHash *rhash, cfile *ref_cfh, unsigned int seed_len, unsigned int sample_rate, unsigned long hr_size,
+				  unsigned int huge_pages)
+{
+	flat_hash *hash;
+	unsigned long entries;
+
+	common_init_RefHash(rhash, ref_cfh, seed_len, sample_rate, RH_FLAT_HASH, rh_flat_hash_insert, rh_flat_hash_free,
+						rh_flat_hash_lookup);
+	assert((unsigned long long)cfile_len(ref_cfh) <= RH_FLAT_MAX_OFFSET);
+	if (hr_size == 0)
+		hr_size = DEFAULT_RHASH_SIZE;
+	if (hr_size < MIN_RHASH_SIZE)
+		hr_size = MIN_RHASH_SIZE;
+	/* hold as many entries as a bucket hash of hr_size would, but no more than the reference can
+	   yield- each insert is followed by a skip of sample_rate. */
+	entries = hr_size * MIN(DEFAULT_RHASH_BUCKET_SIZE, UCHAR_MAX);
+	entries = MIN(entries, cfile_len(ref_cfh) / MAX(sample_rate, 1) + 1);
+
+	if ((hash = (flat_hash *)malloc(sizeof(flat_hash))) == NULL)
+		return MEM_ERROR;
+	if (rh_flat_table_init(hash, entries, huge_pages))
+	{
+		free(hash);
+		return MEM_ERROR;
+	}
+	rhash->hr_size = 1UL << hash->bits;
+	rhash->hash = (void *)hash;
+	rhash->prefetch = rh_flat_hash_prefetch;
+	dcb_lprintf(2, "flat hash: %lu slots, %s\n", rhash->hr_size, hash->mmapped ? "mmap'd" : "malloc'd");
+	return 0;
+}
+
+static off_u64
+rh_sort_hash_lookup(RefHash *rhash, ADLER32_SEED_CTX *ads)
+{
+	sorted_hash *hash = (sorted_hash *)rhash->hash;
+	unsigned int key, d, *base;
+	unsigned long len, half;
+	key = (unsigned int)(get_checksum(ads) & 0xffffffff);
+	d = key >> (32 - hash->dir_bits);
+	base = hash->keys + hash->dir[d];
+	len = hash->dir[d + 1] - hash->dir[d];
+	if (len == 0)
+		return 0;
+	// branchless lower bound; runs are a handful of entries, usually one cacheline.
+	while (len > 1)
+	{
+		half = len / 2;
+		base = (base[half] <= key ? base + half : base);
+		len -= half;
+	}
+	return (*base == key ? hash->offsets[base - hash->keys] : 0);
+}
+
+// the run can't be known until the directory is read; prefetch the directory slot.
+static void
+rh_sort_hash_prefetch(RefHash *rhash, unsigned long chksum)
+{
+	sorted_hash *hash = (sorted_hash *)rhash->hash;
+	__builtin_prefetch(hash->dir + ((unsigned int)(chksum & 0xffffffff) >> (32 - hash->dir_bits)));
+}
+
+static void
+rh_sort_hash_free(RefHash *rhash)
+{
+	sorted_hash *hash = (sorted_hash *)rhash->hash;
+	if (hash->mmapped)
+	{
+		rh_munmap(hash->dir, ((1UL << hash->dir_bits) + 1) * sizeof(unsigned int));
+		if (hash->keys)
+			rh_munmap(hash->keys, hash->count * sizeof(unsigned int));
+		if (hash->offsets)
+			rh_munmap(hash->offsets, hash->count * sizeof(off_u64));
+	}
+	else
+	{
+		free(hash->dir);
+		free(hash->keys);
+		free(hash->offsets);
+	}
+	free(hash);
+}
+
+/* convert a built (and for reverse hashes, cleansed) bucket hash into a sorted_hash.  The table
+   can't be inserted into afterwards.  Other hash types are left as is. */
+signed int
+RHash_freeze(RefHash *rhash)
+{
+	bucket *src = (bucket *)rhash->hash;
+	sorted_hash *hash;
+	off_u64 offset;
+	unsigned long x, y, count = 0, dir_len;
+	unsigned int bits, d, key, *pos;
+
+	if (!(rhash->type & (RH_BUCKET_HASH | RH_RBUCKET_HASH)))
+		return 0;
+	for (x = 0; x < rhash->hr_size; x++)
+	{
+		for (y = 0; y < src->depth[x]; y++)
+		{
+			if (src->offset[x][y] != 0)
+				count++;
+		}
+	}
+	for (bits = 1; bits < 31 && (1UL << bits) * RH_SORT_DIR_RUN < count; bits++)
+		;
+	dir_len = 1UL << bits;
+
+	if ((hash = (sorted_hash *)malloc(sizeof(sorted_hash))) == NULL)
+		return MEM_ERROR;
+	hash->dir_bits = bits;
+	hash->count = count;
+	hash->mmapped = 0;
+	hash->dir = (unsigned int *)calloc(dir_len + 1, sizeof(unsigned int));
+	hash->keys = (unsigned int *)malloc(MAX(count, 1) * sizeof(unsigned int));
+	hash->offsets = (off_u64 *)malloc(MAX(count, 1) * sizeof(off_u64));
+	pos = (unsigned int *)malloc(dir_len * sizeof(unsigned int));
+	if (hash->dir == NULL || hash->keys == NULL || hash->offsets == NULL || pos == NULL)
+	{
+		free(hash->dir);
+		free(hash->keys);
+		free(hash->offsets);
+		free(hash);
+		free(pos);
+		return MEM_ERROR;
+	}
+
+	/* counting sort on the directory bits, then sort each run.  Keys are the low 32 bits of the
+	   chksum- the bucket index and the bottom half of its tag. */
+	for (x = 0; x < rhash->hr_size; x++)
+	{
+		for (y = 0; y < src->depth[x]; y++)
+		{
+			if (src->offset[x][y] != 0)
+				hash->dir[(((unsigned int)src->chksum[x][y] << 16) | x) >> (32 - bits)]++;
+		}
+	}
+	for (x = 0, count = 0; x < dir_len; x++)
+	{
+		y = hash->dir[x];
+		hash->dir[x] = pos[x] = count;
+		count += y;
+	}
+	hash->dir[dir_len] = count;
+	for (x = 0; x < rhash->hr_size; x++)
+	{
+		for (y = 0; y < src->depth[x]; y++)
+		{
+			if (src->offset[x][y] == 0)
+				continue;
+			key = ((unsigned int)src->chksum[x][y] << 16) | x;
+			hash->keys[pos[key >> (32 - bits)]] = key;
+			hash->offsets[pos[key >> (32 - bits)]++] = src->offset[x][y];
+		}
+	}
+	free(pos);
+	for (d = 0; d < dir_len; d++)
+	{
+		for (x = hash->dir[d] + 1; x < hash->dir[d + 1]; x++)
+		{
+			key = hash->keys[x];
+			offset = hash->offsets[x];
+			for (y = x; y > hash->dir[d] && hash->keys[y - 1] > key; y--)
+			{
+				hash->keys[y] = hash->keys[y - 1];
+				hash->offsets[y] = hash->offsets[y - 1];
+			}
+			hash->keys[y] = key;
+			hash->offsets[y] = offset;
+		}
+	}
+	// cleansing dropped entries the filter still holds; rebuild it from what survived.
+	if (rhash->filter)
+	{
+		memset(rhash->filter->bits, 0, rhash->filter->blocks * RH_FILTER_BLOCK_WORDS * sizeof(unsigned long long));
+		for (x = 0; x < count; x++)
+			rh_filter_add(rhash->filter, hash->keys[x]);
+	}
+
+	rhash->free_hash(rhash);
+	rhash->hash = (void *)hash;
+	rhash->type = (rhash->type == RH_RBUCKET_HASH ? RH_RSORT_HASH : RH_SORT_HASH);
+	rhash->flags |= RH_FINALIZED | RH_SORTED;
+	rhash->hr_size = count;
+	rhash->inserts = count;
+	rhash->hash_insert = NULL;
+	rhash->insert_match = NULL;
+	rhash->cleanse_hash = NULL;
+	rhash->free_hash = rh_sort_hash_free;
+	rhash->lookup_offset = rh_sort_hash_lookup;
+	rhash->prefetch = rh_sort_hash_prefetch;
+	dcb_lprintf(1, "froze hash: %lu entries, %lu bytes\n", count,
+				(unsigned long)(count * (sizeof(unsigned int) + sizeof(off_u64)) + (dir_len + 1) * sizeof(unsigned int)));
+	return 0;
+}
+
+#define RH_INDEX_ALIGNED(x) (((unsigned long long)(x) + RH_INDEX_ALIGN - 1) & ~(RH_INDEX_ALIGN - 1))
+#define RH_FINGERPRINT_PRIME (0x100000001b3ULL)
+
+/* cheap content fingerprint of the whole reference; word at a time, independent of how cfile
+   pages the data. */
+signed int
+RHash_ref_fingerprint(cfile *ref_cfh, unsigned long long *fingerprint)
+{
+	cfile_window *cfw;
+	unsigned long long h = 0xcbf29ce484222325ULL, word = 0;
+	unsigned long x, partial = 0;
+	size_t start = ctell(ref_cfh, CSEEK_FSTART);
+	if (0 != cseek(ref_cfh, 0, CSEEK_FSTART))
+		return IO_ERROR;
+	for (cfw = expose_page(ref_cfh); cfw != NULL && cfw->end != 0; cfw = next_page(ref_cfh))
+	{
+		for (x = cfw->pos; x < cfw->end;)
+		{
+			if (partial == 0 && x + sizeof(word) <= cfw->end)
+			{
+				memcpy(&word, cfw->buff + x, sizeof(word));
+				x += sizeof(word);
+			}
+			else
+			{
+				((unsigned char *)&word)[partial++] = cfw->buff[x++];
+				if (partial < sizeof(word))
+					continue;
+				partial = 0;
+			}
+			h = (h ^ word) * RH_FINGERPRINT_PRIME;
+			h ^= h >> 32;
+		}
+	}
+	if (cfw == NULL)
+		return IO_ERROR;
+	if (partial)
+	{
+		memset((unsigned char *)&word + partial, 0, sizeof(word) - partial);
+		h = (h ^ word) * RH_FINGERPRINT_PRIME;
+	}
+	*fingerprint = h ^ (unsigned long long)cfile_len(ref_cfh);
+	if (start != cseek(ref_cfh, start, CSEEK_FSTART))
+		return IO_ERROR;
+	return 0;
+}
+
+static signed int
+rh_index_write_all(int fd, const void *buff, unsigned long long len, unsigned long long offset)
+{
+	ssize_t x;
+	while (len)
+	{
+		x = pwrite(fd, buff, MIN(len, 1ULL << 30), offset);
+		if (x <= 0)
+			return IO_ERROR;
+		buff = (const unsigned char *)buff + x;
+		len -= x;
+		offset += x;
+	}
+	return 0;
+}
+
+static int
+cmp_rh_index_record(const void *r1, const void *r2)
+{
+	const rh_index_record *a = (const rh_index_record *)r1, *b = (const rh_index_record *)r2;
+	if (a->ref_start != b->ref_start)
+		return (a->ref_start < b->ref_start ? -1 : 1);
+	if (a->ref_end != b->ref_end)
+		return (a->ref_end < b->ref_end ? -1 : 1);
+	if (a->seed_len != b->seed_len)
+		return (a->seed_len < b->seed_len ? -1 : 1);
+	if (a->sample_rate != b->sample_rate)
+		return (a->sample_rate < b->sample_rate ? -1 : 1);
+	if (a->sampling != b->sampling)
+		return (a->sampling < b->sampling ? -1 : 1);
+	if (a->init_type != b->init_type)
+		return (a->init_type < b->init_type ? -1 : 1);
+	return (a->init_hr_size == b->init_hr_size ? 0 : a->init_hr_size < b->init_hr_size ? -1
+																						: 1);
+}
+
+/* open the index at path for ref_cfh.  A missing, stale or unreadable index isn't an error- it's
+   treated as empty, and rewritten on the first store. */
+signed int
+RHash_index_open(RefHashIndex *idx, cfile *ref_cfh, const char *path)
+{
+	rh_index_file_header header;
+	rh_index_record rec;
+	struct stat st;
+	unsigned long long pos, end;
+	unsigned long size = 0;
+	unsigned int x;
+	signed int err;
+
+	memset(idx, 0, sizeof(RefHashIndex));
+	idx->fd = idx->tmp_fd = -1;
+	if ((idx->path = strdup(path)) == NULL)
+		return MEM_ERROR;
+	memcpy(idx->header.magic, RH_INDEX_MAGIC, sizeof(idx->header.magic));
+	idx->header.version = RH_INDEX_VERSION;
+	idx->header.ent_size = sizeof(off_u64);
+	idx->header.ref_len = cfile_len(ref_cfh);
+	if ((err = RHash_ref_fingerprint(ref_cfh, &idx->header.ref_fingerprint)))
+		return err;
+
+	if ((idx->fd = open(path, O_RDONLY)) == -1)
+	{
+		dcb_lprintf(1, "no usable index at %s, it will be created\n", path);
+		return 0;
+	}
+	if (fstat(idx->fd, &st) || pread(idx->fd, &header, sizeof(header), 0) != sizeof(header) ||
+		memcmp(header.magic, idx->header.magic, sizeof(header.magic)) ||
+		header.version != idx->header.version || header.ent_size != idx->header.ent_size)
+	{
+		dcb_lprintf(0, "index %s is unreadable or from an incompatible version, rebuilding it\n", path);
+		goto stale;
+	}
+	if (header.ref_len != idx->header.ref_len || header.ref_fingerprint != idx->header.ref_fingerprint)
+	{
+		dcb_lprintf(0, "index %s was built against a different reference, rebuilding it\n", path);
+		goto stale;
+	}
+
+	for (pos = RH_INDEX_ALIGNED(sizeof(rh_index_file_header)); pos + sizeof(rec) <= st.st_size;)
+	{
+		if (pread(idx->fd, &rec, sizeof(rec), pos) != sizeof(rec))
+			break;
+		for (x = 0, end = pos + sizeof(rec); x < RH_INDEX_ARRAYS; x++)
+		{
+			if (rec.data_len[x] && (rec.data_offset[x] % RH_INDEX_ALIGN ||
+									rec.data_offset[x] + rec.data_len[x] > st.st_size))
+				break;
+			end = MAX(end, rec.data_offset[x] + rec.data_len[x]);
+		}
+		if (x != RH_INDEX_ARRAYS)
+		{
+			dcb_lprintf(0, "index %s is truncated; ignoring records past %llu\n", path, pos);
+			break;
+		}
+		if (idx->record_count == size)
+		{
+			size = MAX(16, size * 2);
+			if ((idx->records = (rh_index_record *)realloc(idx->records, size * sizeof(rh_index_record))) == NULL)
+				return MEM_ERROR;
+		}
+		idx->records[idx->record_count++] = rec;
+		pos = RH_INDEX_ALIGNED(end);
+	}
+	idx->valid_len = RH_INDEX_ALIGNED(pos);
+	qsort(idx->records, idx->record_count, sizeof(rh_index_record), cmp_rh_index_record);
+	dcb_lprintf(1, "index %s holds %lu hashes\n", path, idx->record_count);
+	return 0;
+
+stale:
+	close(idx->fd);
+	idx->fd = -1;
+	return 0;
+}
+
+// index arrays needn't be page aligned; map from the page holding the start.
+static void *
+rh_index_map(int fd, unsigned long long offset, unsigned long long len)
+{
+	unsigned long long delta = offset % sysconf(_SC_PAGESIZE);
+	unsigned char *p;
+	if (len == 0)
+		return NULL;
+	p = (unsigned char *)mmap(NULL, len + delta, PROT_READ, MAP_SHARED, fd, offset - delta);
+	if (p == (unsigned char *)MAP_FAILED)
+		return NULL;
+#ifdef MADV_WILLNEED
+	madvise(p, len + delta, MADV_WILLNEED);
+#endif
+	return p + delta;
+}
+
+/* look up a hash of [ref_start, ref_end) built with seed_len and sample_rate by an init of the
+   given type and hr_size, and map it into rhash for ref_cfh.  Returns 1 if found, 0 if not (the
+   caller builds it), or an error. */
+signed int
+RHash_index_load(RefHashIndex *idx, RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end,
+				 unsigned int seed_len, unsigned int sample_rate, unsigned int sampling, unsigned int type,
+				 unsigned long hr_size)
+{
+	rh_index_record key, *rec;
+	flat_hash *fhash;
+	sorted_hash *shash;
+
+	if (idx->fd == -1)
+		return 0;
+	key.ref_start = ref_start;
+	key.ref_end = ref_end;
+	key.seed_len = seed_len;
+	key.sample_rate = sample_rate;
+	key.sampling = sampling;
+	key.init_type = type;
+	key.init_hr_size = hr_size;
+	rec = (rh_index_record *)bsearch(&key, idx->records, idx->record_count, sizeof(rh_index_record), cmp_rh_index_record);
+	if (rec == NULL)
+		return 0;
+
+	if (rec->type == RH_FLAT_HASH)
+	{
+		if (rec->param < 16 || rec->param > 40 || rec->data_len[0] != (sizeof(unsigned long long) << rec->param))
+			return 0;
+		if ((fhash = (flat_hash *)malloc(sizeof(flat_hash))) == NULL)
+			return MEM_ERROR;
+		if ((fhash->table = (unsigned long long *)rh_index_map(idx->fd, rec->data_offset[0], rec->data_len[0])) == NULL)
+		{
+			free(fhash);
+			return IO_ERROR;
+		}
+		fhash->bits = rec->param;
+		fhash->mask = (1UL << rec->param) - 1;
+		fhash->fill = fhash->max_fill = rec->count;
+		fhash->alloc_len = rec->data_len[0];
+		fhash->mmapped = 1;
+		common_init_RefHash(rhash, ref_cfh, seed_len, rec->sample_rate, RH_FLAT_HASH, NULL, rh_flat_hash_free,
+							rh_flat_hash_lookup);
+		rhash->hash = (void *)fhash;
+		rhash->prefetch = rh_flat_hash_prefetch;
+	}
+	else if (rec->type & (RH_SORT_HASH | RH_RSORT_HASH))
+	{
+		if (rec->param < 1 || rec->param > 31 ||
+			rec->data_len[0] != ((1ULL << rec->param) + 1) * sizeof(unsigned int) ||
+			rec->data_len[1] != rec->count * sizeof(unsigned int) ||
+			rec->data_len[2] != rec->count * sizeof(off_u64))
+			return 0;
+		if ((shash = (sorted_hash *)malloc(sizeof(sorted_hash))) == NULL)
+			return MEM_ERROR;
+		shash->dir_bits = rec->param;
+		shash->count = rec->count;
+		shash->mmapped = 1;
+		shash->dir = (unsigned int *)rh_index_map(idx->fd, rec->data_offset[0], rec->data_len[0]);
+		shash->keys = (unsigned int *)rh_index_map(idx->fd, rec->data_offset[1], rec->data_len[1]);
+		shash->offsets = (off_u64 *)rh_index_map(idx->fd, rec->data_offset[2], rec->data_len[2]);
+		if (shash->dir == NULL || (rec->count && (shash->keys == NULL || shash->offsets == NULL)))
+		{
+			if (shash->dir)
+				rh_munmap(shash->dir, rec->data_len[0]);
+			if (shash->keys)
+				rh_munmap(shash->keys, rec->data_len[1]);
+			if (shash->offsets)
+				rh_munmap(shash->offsets, rec->data_len[2]);
+			free(shash);
+			return IO_ERROR;
+		}
+		common_init_RefHash(rhash, ref_cfh, seed_len, rec->sample_rate, rec->type, NULL, rh_sort_hash_free,
+							rh_sort_hash_lookup);
+		rhash->hash = (void *)shash;
+		rhash->prefetch = rh_sort_hash_prefetch;
+		rhash->flags |= RH_SORTED;
+	}
+	else
+	{
+		return 0;
+	}
+	rhash->flags |= RH_FINALIZED;
+	rhash->sampling = rec->sampling;
+	rhash->hr_size = rec->hr_size;
+	rhash->inserts = rec->inserts;
+	rhash->duplicates = rec->duplicates;
+	dcb_lprintf(2, "loaded hash of %llu:%llu from index\n", (act_off_u64)ref_start, (act_off_u64)ref_end);
+	return 1;
+}
+
+/* append rhash, a hash of [ref_start, ref_end) initialized as type with hr_size, to the index.
+   Bucket hashes are frozen first.  Appends go to a temporary copy that replaces the index on
+   RHash_index_close. */
+signed int
+RHash_index_store(RefHashIndex *idx, RefHash *rhash, off_u64 ref_start, off_u64 ref_end,
+				  unsigned int type, unsigned long hr_size)
+{
+	rh_index_record rec;
+	const void *data[RH_INDEX_ARRAYS] = {NULL, NULL, NULL};
+	unsigned char *buff;
+	unsigned long long pos;
+	ssize_t x;
+	unsigned int y;
+	signed int err;
+
+	if (rhash->type & (RH_BUCKET_HASH | RH_RBUCKET_HASH))
+	{
+		if ((err = RHash_freeze(rhash)))
+			return err;
+	}
+	memset(&rec, 0, sizeof(rec));
+	rec.type = rhash->type;
+	rec.init_type = type;
+	rec.init_hr_size = hr_size;
+	rec.seed_len = rhash->seed_len;
+	rec.sample_rate = rhash->sample_rate;
+	rec.sampling = rhash->sampling;
+	rec.ref_start = ref_start;
+	rec.ref_end = ref_end;
+	rec.hr_size = rhash->hr_size;
+	rec.inserts = rhash->inserts;
+	rec.duplicates = rhash->duplicates;
+	if (rhash->type == RH_FLAT_HASH)
+	{
+		flat_hash *hash = (flat_hash *)rhash->hash;
+		rec.param = hash->bits;
+		rec.count = hash->fill;
+		data[0] = hash->table;
+		rec.data_len[0] = sizeof(unsigned long long) << hash->bits;
+	}
+	else if (rhash->type & (RH_SORT_HASH | RH_RSORT_HASH))
+	{
+		sorted_hash *hash = (sorted_hash *)rhash->hash;
+		rec.param = hash->dir_bits;
+		rec.count = hash->count;
+		data[0] = hash->dir;
+		rec.data_len[0] = ((1ULL << hash->dir_bits) + 1) * sizeof(unsigned int);
+		data[1] = hash->keys;
+		rec.data_len[1] = hash->count * sizeof(unsigned int);
+		data[2] = hash->offsets;
+		rec.data_len[2] = hash->count * sizeof(off_u64);
+	}
+	else
+	{
+		return FORMAT_ERROR;
+	}
+
+	if (idx->tmp_fd == -1)
+	{
+		if ((idx->tmp_path = (char *)malloc(strlen(idx->path) + 8)) == NULL)
+			return MEM_ERROR;
+		sprintf(idx->tmp_path, "%s.XXXXXX", idx->path);
+		if ((idx->tmp_fd = mkstemp(idx->tmp_path)) == -1)
+		{
+			free(idx->tmp_path);
+			idx->tmp_path = NULL;
+			return IO_ERROR;
+		}
+		fchmod(idx->tmp_fd, 0644);
+		if ((err = rh_index_write_all(idx->tmp_fd, &idx->header, sizeof(idx->header), 0)))
+			return err;
+		idx->tmp_len = RH_INDEX_ALIGNED(sizeof(idx->header));
+		// carry forward what the existing index already holds.
+		if (idx->fd != -1)
+		{
+			if ((buff = (unsigned char *)malloc(1 << 20)) == NULL)
+				return MEM_ERROR;
+			for (pos = idx->tmp_len; pos < idx->valid_len && (x = pread(idx->fd, buff, MIN(1 << 20, idx->valid_len - pos), pos)) > 0;
+				 pos += x)
+			{
+				if ((err = rh_index_write_all(idx->tmp_fd, buff, x, pos)))
+				{
+					free(buff);
+					return err;
+				}
+			}
+			free(buff);
+			idx->tmp_len = RH_INDEX_ALIGNED(pos);
+		}
+	}
+
+	pos = idx->tmp_len;
+	rec.data_offset[0] = RH_INDEX_ALIGNED(pos + sizeof(rec));
+	for (y = 1; y < RH_INDEX_ARRAYS; y++)
+		rec.data_offset[y] = RH_INDEX_ALIGNED(rec.data_offset[y - 1] + rec.data_len[y - 1]);
+	for (y = 0; y < RH_INDEX_ARRAYS; y++)
+	{
+		if (rec.data_len[y] && (err = rh_index_write_all(idx->tmp_fd, data[y], rec.data_len[y], rec.data_offset[y])))
+			return err;
+	}
+	if ((err = rh_index_write_all(idx->tmp_fd, &rec, sizeof(rec), pos)))
+		return err;
+	idx->tmp_len = RH_INDEX_ALIGNED(rec.data_offset[RH_INDEX_ARRAYS - 1] + rec.data_len[RH_INDEX_ARRAYS - 1]);
+	dcb_lprintf(2, "stored hash of %llu:%llu to index\n", (act_off_u64)ref_start, (act_off_u64)ref_end);
+	return 0;
+}
+
+/* release the index; if anything was stored, the updated copy replaces the original.  Hashes
+   loaded from the index stay valid. */
+signed int
+RHash_index_close(RefHashIndex *idx)
+{
+	signed int err = 0;
+	if (idx->tmp_fd != -1)
+	{
+		// pad out to the aligned length so the last record's arrays are fully present.
+		if (ftruncate(idx->tmp_fd, idx->tmp_len) || close(idx->tmp_fd) || rename(idx->tmp_path, idx->path))
+		{
+			unlink(idx->tmp_path);
+			err = IO_ERROR;
+		}
+		else
+		{
+			dcb_lprintf(1, "wrote index %s\n", idx->path);
+		}
+	}
+	if (idx->fd != -1)
+		close(idx->fd);
+	free(idx->tmp_path);
+	free(idx->path);
+	free(idx->records);
+	memset(idx, 0, sizeof(RefHashIndex));
+	idx->fd = idx->tmp_fd = -1;
+	return err;
+}
+
 signed int
 RHash_insert_block(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end)
 {
@@ -365,6 +1166,533 @@ RHash_find_matches(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 re
 	return internal_loop_block(rhash, ref_cfh, ref_start, ref_end, rhash->insert_match);
 }
 
+typedef struct
+{
+	RefHash *rhash;
+	cfile *ref_cfh;
+	off_u64 ref_start, ref_end;
+	int err;
+} rh_build_range;
+
+typedef struct
+{
+	RefHash *rhash;
+	RefHash *tables;
+	unsigned int table_count;
+	unsigned long index_start, index_end;
+	unsigned long duplicates;
+	int err;
+} rh_merge_range;
+
+static void *
+rh_build_range_thread(void *data)
+{
+	rh_build_range *r = (rh_build_range *)data;
+	r->err = internal_loop_block(r->rhash, r->ref_cfh, r->ref_start, r->ref_end, r->rhash->hash_insert);
+	return NULL;
+}
+
+static inline unsigned short
+RH_bucket_alloc_size(unsigned short depth, unsigned short max_depth)
+{
+	unsigned short size = RH_BUCKET_MIN_ALLOC;
+	while (size < depth)
+		size *= RH_BUCKET_REALLOC_RATE;
+	return MIN(size, max_depth);
+}
+
+static int
+cmp_chksum_ent_offset(const void *ce1, const void *ce2)
+{
+	chksum_ent *c1 = (chksum_ent *)ce1;
+	chksum_ent *c2 = (chksum_ent *)ce2;
+	return (c1->offset == c2->offset ? 0 : c1->offset < c2->offset ? -1
+																   : 1);
+}
+
+/* fold each later range's bucket into the primary's, for [index_start, index_end).  A chksum
+   already present wins (it's from an earlier offset); if the bucket can't hold all the new
+   chksums, the lowest offsets get in- same as a serial walk would've done. */
+static void *
+rh_merge_range_thread(void *data)
+{
+	rh_merge_range *r = (rh_merge_range *)data;
+	bucket *hash = (bucket *)r->rhash->hash, *src;
+	chksum_ent *add = NULL;
+	rh_bucket_tag *chksums;
+	off_u64 *offsets;
+	unsigned long index, x, y, z, count;
+	unsigned int t;
+	r->duplicates = 0;
+	r->err = 0;
+	if ((add = (chksum_ent *)malloc(sizeof(chksum_ent) * hash->max_depth)) == NULL)
+	{
+		r->err = MEM_ERROR;
+		return NULL;
+	}
+	for (index = r->index_start; index < r->index_end; index++)
+	{
+		for (t = 0; t < r->table_count; t++)
+		{
+			src = (bucket *)r->tables[t].hash;
+			if (src->depth[index] == 0)
+				continue;
+			// find chksums the primary lacks; both arrays are sorted.
+			count = 0;
+			for (x = 0, y = 0; y < src->depth[index]; y++)
+			{
+				while (x < hash->depth[index] && hash->chksum[index][x] < src->chksum[index][y])
+					x++;
+				if (x < hash->depth[index] && hash->chksum[index][x] == src->chksum[index][y])
+				{
+					r->duplicates++;
+					continue;
+				}
+				add[count].chksum = src->chksum[index][y];
+				add[count].offset = src->offset[index][y];
+				count++;
+			}
+			if (count == 0)
+				continue;
+			if (hash->depth[index] + count > hash->max_depth)
+			{
+				r->duplicates += hash->depth[index] + count - hash->max_depth;
+				qsort(add, count, sizeof(chksum_ent), cmp_chksum_ent_offset);
+				count = hash->max_depth - hash->depth[index];
+				qsort(add, count, sizeof(chksum_ent), cmp_chksum_ent);
+			}
+			z = RH_bucket_alloc_size(hash->depth[index] + count, hash->max_depth);
+			chksums = (rh_bucket_tag *)malloc(z * sizeof(rh_bucket_tag));
+			offsets = (off_u64 *)malloc(z * sizeof(off_u64));
+			if (chksums == NULL || offsets == NULL)
+			{
+				free(chksums);
+				free(offsets);
+				free(add);
+				r->err = MEM_ERROR;
+				return NULL;
+			}
+			for (x = 0, y = 0, z = 0; x < hash->depth[index] || y < count; z++)
+			{
+				if (y == count || (x < hash->depth[index] && hash->chksum[index][x] < add[y].chksum))
+				{
+					chksums[z] = hash->chksum[index][x];
+					offsets[z] = hash->offset[index][x];
+					x++;
+				}
+				else
+				{
+					chksums[z] = add[y].chksum;
+					offsets[z] = add[y].offset;
+					y++;
+				}
+			}
+			free(hash->chksum[index]);
+			free(hash->offset[index]);
+			hash->chksum[index] = chksums;
+			hash->offset[index] = offsets;
+			hash->depth[index] = z;
+		}
+	}
+	free(add);
+	return NULL;
+}
+
+/* a later range's private flat table, plus the chksums it took in the order it took them (which
+   is offset order); replaying that log into the primary is what makes the merge match a serial
+   walk. */
+typedef struct
+{
+	flat_hash table;
+	unsigned long *chksums;
+	unsigned long count, size;
+} rh_flat_range;
+
+static signed int
+rh_flat_range_insert(RefHash *rhash, ADLER32_SEED_CTX *ads, off_u64 offset)
+{
+	rh_flat_range *range = (rh_flat_range *)rhash->hash;
+	unsigned long chksum = get_checksum(ads), *chksums;
+	signed int result = rh_flat_hash_insert_chksum(&range->table, chksum, offset);
+	if (result == FAILED_HASH_INSERT)
+		return result;
+	if (range->count == range->size)
+	{
+		range->size = (range->size ? range->size * 2 : RH_FLAT_RANGE_LOG_SIZE);
+		if ((chksums = (unsigned long *)realloc(range->chksums, range->size * sizeof(unsigned long))) == NULL)
+			return MEM_ERROR;
+		range->chksums = chksums;
+	}
+	range->chksums[range->count++] = chksum;
+	return result;
+}
+
+/* flat hashes can't be merged by index the way buckets are; probing moves entries off their home
+   slot, and only a tag of the chksum is kept.  So the first range goes straight into rhash, the
+   rest into private tables that log what they took, and the logs are replayed into rhash in range
+   order once every range is done. */
+static signed int
+rh_flat_insert_block_parallel(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end,
+							  unsigned int thread_count)
+{
+	flat_hash *hash = (flat_hash *)rhash->hash;
+	rh_build_range *builds;
+	rh_flat_range *ranges;
+	RefHash *copies;
+	pthread_t *threads;
+	off_u64 range_len, offset;
+	unsigned long y;
+	unsigned int x, started;
+	int err = 0, result = 0;
+
+	builds = (rh_build_range *)calloc(thread_count, sizeof(rh_build_range));
+	ranges = (rh_flat_range *)calloc(thread_count, sizeof(rh_flat_range));
+	copies = (RefHash *)calloc(thread_count, sizeof(RefHash));
+	threads = (pthread_t *)calloc(thread_count, sizeof(pthread_t));
+	if (builds == NULL || ranges == NULL || copies == NULL || threads == NULL)
+	{
+		err = MEM_ERROR;
+		goto cleanup;
+	}
+	range_len = (ref_end - ref_start) / thread_count;
+	dcb_lprintf(1, "building flat hash across %u threads, ~%llu bytes each\n", thread_count, (act_off_u64)range_len);
+	for (x = 0; x < thread_count; x++)
+	{
+		builds[x].ref_start = ref_start + x * range_len;
+		builds[x].ref_end = (x + 1 == thread_count ? ref_end : MIN(ref_end, ref_start + (x + 1) * range_len + rhash->seed_len - 1));
+		if (x == 0)
+		{
+			builds[x].rhash = rhash;
+			builds[x].ref_cfh = ref_cfh;
+			continue;
+		}
+		copies[x] = *rhash;
+		copies[x].hash = (void *)(ranges + x);
+		copies[x].hash_insert = rh_flat_range_insert;
+		copies[x].inserts = copies[x].duplicates = 0;
+		builds[x].rhash = copies + x;
+		if ((err = rh_flat_table_init(&ranges[x].table, MIN(builds[x].ref_end - builds[x].ref_start + 1, hash->max_fill), 0)))
+		{
+			goto cleanup;
+		}
+		if ((builds[x].ref_cfh = copen_dup_cfh(ref_cfh)) == NULL)
+		{
+			err = MEM_ERROR;
+			goto cleanup;
+		}
+	}
+
+	for (started = 0; started < thread_count; started++)
+	{
+		if (pthread_create(threads + started, NULL, rh_build_range_thread, builds + started))
+			break;
+	}
+	for (x = started; x < thread_count; x++)
+		rh_build_range_thread(builds + x);
+	for (x = 0; x < started; x++)
+		pthread_join(threads[x], NULL);
+
+	for (x = 0; x < thread_count; x++)
+	{
+		if (builds[x].err && !err)
+			err = builds[x].err;
+		if (x)
+			rhash->duplicates += copies[x].duplicates;
+	}
+	if (err)
+		goto cleanup;
+
+	// a tag already present came from an earlier offset, and keeps it.
+	for (x = 1; x < thread_count && result != SUCCESSFULL_HASH_INSERT_NOW_IS_FULL && hash->fill < hash->max_fill; x++)
+	{
+		for (y = 0; y < ranges[x].count; y++)
+		{
+			offset = RH_FLAT_ENT_OFFSET(ranges[x].table.table[rh_flat_hash_probe(&ranges[x].table, ranges[x].chksums[y])]);
+			result = rh_flat_hash_insert_chksum(hash, ranges[x].chksums[y], offset);
+			if (result == FAILED_HASH_INSERT)
+			{
+				rhash->duplicates++;
+				continue;
+			}
+			rhash->inserts++;
+			if (result == SUCCESSFULL_HASH_INSERT_NOW_IS_FULL)
+				break;
+		}
+	}
+
+cleanup:
+	for (x = 1; builds && ranges && x < thread_count; x++)
+	{
+		if (builds[x].ref_cfh)
+		{
+			cclose(builds[x].ref_cfh);
+			free(builds[x].ref_cfh);
+		}
+		if (ranges[x].table.table)
+			rh_flat_table_free(&ranges[x].table);
+		free(ranges[x].chksums);
+	}
+	free(builds);
+	free(ranges);
+	free(copies);
+	free(threads);
+	return err;
+}
+
+/* Build the hash across thread_count threads.  The reference is split into contiguous ranges;
+   the first is inserted straight into rhash, the rest into private tables which are then merged
+   in range order; bucket hashes split that merge by bucket index across the same threads.
+   Only done when every offset is sampled; with sample_rate > 1 which offsets get sampled
+   depends on every insert before them (skip sample_rate on an insert, step a byte on a
+   duplicate), which a range can't know, so that's built serially.  With every offset sampled
+   the lowest offset wins each chksum, same as a serial build. */
+signed int
+RHash_insert_block_parallel(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end,
+							unsigned int thread_count)
+{
+	rh_build_range *builds;
+	rh_merge_range *merges;
+	RefHash *tables;
+	pthread_t *threads;
+	off_u64 range_len;
+	unsigned long index_len;
+	unsigned int x, started;
+	int err = 0;
+
+	if (ref_end > ref_start)
+		thread_count = MIN(thread_count, (ref_end - ref_start) / MIN_PARALLEL_HASH_RANGE_LEN);
+	if (thread_count <= 1 || rhash->sample_rate > 1 || !(rhash->type & (RH_BUCKET_HASH | RH_FLAT_HASH)) ||
+		ref_cfh->compressor_type != NO_COMPRESSOR || (ref_cfh->state_flags & CFILE_CHILD_INHERITS_IO))
+	{
+		return RHash_insert_block(rhash, ref_cfh, ref_start, ref_end);
+	}
+	if (rhash->type == RH_FLAT_HASH)
+		return rh_flat_insert_block_parallel(rhash, ref_cfh, ref_start, ref_end, thread_count);
+
+	builds = (rh_build_range *)calloc(thread_count, sizeof(rh_build_range));
+	merges = (rh_merge_range *)calloc(thread_count, sizeof(rh_merge_range));
+	tables = (RefHash *)calloc(thread_count, sizeof(RefHash));
+	threads = (pthread_t *)calloc(thread_count, sizeof(pthread_t));
+	if (builds == NULL || merges == NULL || tables == NULL || threads == NULL)
+	{
+		err = MEM_ERROR;
+		goto cleanup;
+	}
+	range_len = (ref_end - ref_start) / thread_count;
+	dcb_lprintf(1, "building hash across %u threads, ~%llu bytes each\n", thread_count, (act_off_u64)range_len);
+
+	for (x = 0; x < thread_count; x++)
+	{
+		builds[x].ref_start = ref_start + x * range_len;
+		// an insert at offset p needs p + seed_len <= ref_end; ranges own offsets, not bytes.
+		builds[x].ref_end = (x + 1 == thread_count ? ref_end : MIN(ref_end, ref_start + (x + 1) * range_len + rhash->seed_len - 1));
+		if (x == 0)
+		{
+			builds[x].rhash = rhash;
+			builds[x].ref_cfh = ref_cfh;
+			continue;
+		}
+		builds[x].rhash = tables + x;
+		if ((err = common_rh_bucket_hash_init(tables + x, ref_cfh, rhash->seed_len, rhash->sample_rate,
+											  MIN_RHASH_SIZE, RH_BUCKET_HASH)))
+		{
+			goto cleanup;
+		}
+		// keys only ever go into the filter; merging can't invalidate them.
+		tables[x].filter = rhash->filter;
+		if ((builds[x].ref_cfh = copen_dup_cfh(ref_cfh)) == NULL)
+		{
+			err = MEM_ERROR;
+			goto cleanup;
+		}
+	}
+
+	for (started = 0; started < thread_count; started++)
+	{
+		if (pthread_create(threads + started, NULL, rh_build_range_thread, builds + started))
+			break;
+	}
+	for (x = started; x < thread_count; x++)
+		rh_build_range_thread(builds + x);
+	for (x = 0; x < started; x++)
+		pthread_join(threads[x], NULL);
+
+	for (x = 0; x < thread_count; x++)
+	{
+		if (builds[x].err && !err)
+			err = builds[x].err;
+		if (x)
+		{
+			rhash->inserts += tables[x].inserts;
+			rhash->duplicates += tables[x].duplicates;
+		}
+	}
+	if (err)
+		goto cleanup;
+
+	index_len = (RHASH_INDEX_MASK + 1) / thread_count;
+	for (x = 0; x < thread_count; x++)
+	{
+		merges[x].rhash = rhash;
+		merges[x].tables = tables + 1;
+		merges[x].table_count = thread_count - 1;
+		merges[x].index_start = x * index_len;
+		merges[x].index_end = (x + 1 == thread_count ? RHASH_INDEX_MASK + 1 : (x + 1) * index_len);
+	}
+	for (started = 0; started < thread_count; started++)
+	{
+		if (pthread_create(threads + started, NULL, rh_merge_range_thread, merges + started))
+			break;
+	}
+	for (x = started; x < thread_count; x++)
+		rh_merge_range_thread(merges + x);
+	for (x = 0; x < started; x++)
+		pthread_join(threads[x], NULL);
+	for (x = 0; x < thread_count; x++)
+	{
+		if (merges[x].err && !err)
+			err = merges[x].err;
+		rhash->inserts -= merges[x].duplicates;
+		rhash->duplicates += merges[x].duplicates;
+	}
+
+cleanup:
+	for (x = 1; tables && builds && x < thread_count; x++)
+	{
+		tables[x].filter = NULL;
+		if (tables[x].hash)
+			free_RefHash(tables + x);
+		if (builds[x].ref_cfh)
+		{
+			cclose(builds[x].ref_cfh);
+			free(builds[x].ref_cfh);
+		}
+	}
+	free(builds);
+	free(merges);
+	free(tables);
+	free(threads);
+	return err;
+}
+
+typedef struct
+{
+	unsigned long long mixed;
+	unsigned long chksum;
+	off_u64 offset;
+} rh_winnow_ent;
+
+/* winnowing, per Schleimer, Wilkerson & Aiken: the offsets of [ref_start, ref_end) are rolled
+   densely, and of every window of w consecutive ones the smallest (rightmost on ties) is inserted
+   once.  Any match of at least w + seed_len - 1 bytes thus has an insert inside it wherever it
+   falls, and identical content picks identical anchors; with w = 2 * sample_rate - 1 the insert
+   count matches the stride's. */
+static signed int
+internal_winnow_block(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end, hash_insert_func hif)
+{
+	ADLER32_SEED_CTX ads, probe;
+	unsigned long w = RH_WINNOW_WINDOW(rhash->sample_rate), count = 0, min = 0, x, y, len, slot;
+	unsigned char *buff = NULL;
+	unsigned long *chksums = NULL;
+	rh_winnow_ent *win = NULL, *ent;
+	off_u64 offset = ref_start, last_insert = 0;
+	int have_insert = 0, leaving;
+	signed int result = 0;
+
+	if (ref_end < ref_start + rhash->seed_len)
+		return 0;
+	if (init_adler32_seed(&ads, rhash->seed_len))
+		return MEM_ERROR;
+	buff = (unsigned char *)malloc(rhash->seed_len + RH_WINNOW_READ_LEN);
+	chksums = (unsigned long *)malloc(RH_WINNOW_READ_LEN * sizeof(unsigned long));
+	win = (rh_winnow_ent *)malloc(w * sizeof(rh_winnow_ent));
+	if (buff == NULL || chksums == NULL || win == NULL)
+	{
+		result = MEM_ERROR;
+		goto cleanup;
+	}
+	if (ref_start != cseek(ref_cfh, ref_start, CSEEK_FSTART) ||
+		rhash->seed_len != cread(ref_cfh, buff, rhash->seed_len))
+	{
+		result = IO_ERROR;
+		goto cleanup;
+	}
+	update_adler32_seed(&ads, buff, rhash->seed_len);
+	chksums[0] = get_checksum(&ads);
+	len = 1;
+	probe = ads;
+	for (;;)
+	{
+		for (x = 0; x < len; x++, offset++)
+		{
+			// the window is a ring; the newest offset takes the oldest's slot.
+			slot = offset % w;
+			leaving = (count == w && min == slot);
+			ent = win + slot;
+			ent->chksum = chksums[x];
+			ent->mixed = (unsigned long long)chksums[x] * 0x9e3779b97f4a7c15ULL;
+			ent->mixed ^= ent->mixed >> 29;
+			ent->offset = offset;
+			if (count < w)
+				count++;
+			if (leaving)
+			{
+				// the minimum slid out; rescan oldest to newest, keeping the rightmost of equals.
+				for (y = 1, min = (offset + 1) % w; y < w; y++)
+				{
+					if (win[(offset + 1 + y) % w].mixed <= win[min].mixed)
+						min = (offset + 1 + y) % w;
+				}
+			}
+			else if (count == 1 || ent->mixed <= win[min].mixed)
+				min = slot;
+			if (count < w && offset + 1 + rhash->seed_len <= ref_end)
+				continue;
+			if (have_insert && last_insert == win[min].offset)
+				continue;
+			have_insert = 1;
+			last_insert = win[min].offset;
+			probe.s2 = win[min].chksum;
+			result = hif(rhash, &probe, win[min].offset);
+			if (result < 0)
+				goto cleanup;
+			if (result == FAILED_HASH_INSERT)
+			{
+				rhash->duplicates++;
+				continue;
+			}
+			rhash->inserts++;
+			if (rhash->filter)
+				rh_filter_add(rhash->filter, win[min].chksum);
+			if (result == SUCCESSFULL_HASH_INSERT_NOW_IS_FULL)
+			{
+				result = 0;
+				goto cleanup;
+			}
+		}
+		// offset is the next seed's start; roll in what's left up to ref_end.
+		if (offset + rhash->seed_len > ref_end)
+			break;
+		len = MIN(RH_WINNOW_READ_LEN, ref_end - (offset + rhash->seed_len - 1));
+		if (len != cread(ref_cfh, buff + rhash->seed_len, len))
+		{
+			result = IO_ERROR;
+			goto cleanup;
+		}
+		adler32_roll_block(&ads, buff + rhash->seed_len, len, chksums);
+		memmove(buff, buff + len, rhash->seed_len);
+		probe = ads;
+	}
+	result = 0;
+
+cleanup:
+	free_adler32_seed(&ads);
+	free(buff);
+	free(chksums);
+	free(win);
+	return result;
+}
+
 static signed int
 internal_loop_block(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 ref_end, hash_insert_func hif)
 {
@@ -373,6 +1701,10 @@ internal_loop_block(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 r
 	unsigned long len;
 	signed int result;
 	cfile_window *cfw;
+	// match walks only consult the filter.
+	rh_filter *filter = (hif == rhash->insert_match ? NULL : rhash->filter);
+	if (rhash->sampling == RH_SAMPLE_WINNOW && rhash->sample_rate > 1 && hif != rhash->insert_match)
+		return internal_winnow_block(rhash, ref_cfh, ref_start, ref_end, hif);
 	if (init_adler32_seed(&ads, rhash->seed_len))
 		return MEM_ERROR;
 	cseek(ref_cfh, ref_start, CSEEK_FSTART);
@@ -428,6 +1760,8 @@ internal_loop_block(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 r
 		else if (result == SUCCESSFULL_HASH_INSERT)
 		{
 			rhash->inserts++;
+			if (filter)
+				rh_filter_add(filter, get_checksum(&ads));
 			if (rhash->sample_rate <= 1)
 			{
 				len = 1;
@@ -449,6 +1783,8 @@ internal_loop_block(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 r
 		else if (result == SUCCESSFULL_HASH_INSERT_NOW_IS_FULL)
 		{
 			rhash->inserts++;
+			if (filter)
+				rh_filter_add(filter, get_checksum(&ads));
 			free_adler32_seed(&ads);
 			return 0;
 		}
@@ -457,6 +1793,50 @@ internal_loop_block(RefHash *rhash, cfile *ref_cfh, off_u64 ref_start, off_u64 r
 			break;
 		}
 
+		/* dense insertion; roll a block of windows at once, inserting all but the last.  The last
+		   is left in ads for the insert at the top of the loop.  Only when every offset is sampled-
+		   with sample_rate > 1 a duplicate steps a byte, but the next insert has to skip again. */
+		if (rhash->sample_rate <= 1 && len == 1 && skip == 0 && cfw->pos >= rhash->seed_len && cfw->pos + 1 < cfw->end)
+		{
+			ADLER32_SEED_CTX probe;
+			unsigned long chksums[ADLER32_BLOCK_LEN];
+			unsigned long x;
+			len = MIN(cfw->end - cfw->pos, ref_end - (cfw->offset + cfw->pos));
+			len = MIN(len, ADLER32_BLOCK_LEN);
+			adler32_roll_block(&ads, cfw->buff + cfw->pos, len, chksums);
+			probe = ads;
+			for (x = 0; x + 1 < len; x++)
+			{
+				probe.s2 = chksums[x];
+				result = hif(rhash, &probe, cfw->offset + cfw->pos + x + 1 - rhash->seed_len);
+				if (result < 0)
+				{
+					free_adler32_seed(&ads);
+					return result;
+				}
+				else if (result == SUCCESSFULL_HASH_INSERT)
+				{
+					rhash->inserts++;
+					if (filter)
+						rh_filter_add(filter, chksums[x]);
+				}
+				else if (result == FAILED_HASH_INSERT)
+				{
+					rhash->duplicates++;
+				}
+				else if (result == SUCCESSFULL_HASH_INSERT_NOW_IS_FULL)
+				{
+					rhash->inserts++;
+					if (filter)
+						rh_filter_add(filter, chksums[x]);
+					free_adler32_seed(&ads);
+					return 0;
+				}
+			}
+			cfw->pos += len;
+			continue;
+		}
+
 		/* position ourself */
 		while (cfw->pos + skip >= cfw->end)
 		{
@@ -501,10 +1881,12 @@ rh_rbucket_insert_match(RefHash *rhash, ADLER32_SEED_CTX *ads, off_u64 offset)
 	unsigned long index, chksum;
 	signed int pos;
 	chksum = get_checksum(ads);
+	if (!RHash_filter_test(rhash->filter, chksum))
+		return FAILED_HASH_INSERT;
 	index = (chksum & RHASH_INDEX_MASK);
 	if (hash->depth[index])
 	{
-		chksum = ((chksum >> 16) & 0xffff);
+		chksum = RH_BUCKET_TAG(chksum);
 		pos = RH_bucket_find_chksum(chksum, hash->chksum[index], hash->depth[index]);
 		if (pos >= 0 && hash->offset[index][pos] == 0)
 		{
@@ -551,7 +1933,7 @@ rh_rbucket_cleanse(RefHash *rhash)
 				continue;
 			}
 			rhash->inserts += hash->depth[x];
-			if ((hash->chksum[x] = (unsigned short *)realloc(hash->chksum[x], sizeof(unsigned short) * hash->depth[x])) == NULL ||
+			if ((hash->chksum[x] = (rh_bucket_tag *)realloc(hash->chksum[x], sizeof(rh_bucket_tag) * hash->depth[x])) == NULL ||
 				(hash->offset[x] = (off_u64 *)realloc(hash->offset[x], sizeof(off_u64) * hash->depth[x])) == NULL)
 			{
 				return MEM_ERROR;
@@ -576,4 +1958,24 @@ void print_RefHash_stats(RefHash *rhash)
 #endif
 	dcb_lprintf(1, "hash stats: seed_len(%u), sample_rate(%u)\n", rhash->seed_len,
 				rhash->sample_rate);
+	if (rhash->filter)
+	{
+		unsigned long x, words = rhash->filter->blocks * RH_FILTER_BLOCK_WORDS, set = 0;
+		double fill, fp = 1.0;
+		for (x = 0; x < words; x++)
+			set += __builtin_popcountll(rhash->filter->bits[x]);
+		fill = (double)set / (words * 64);
+		// a query passes if all of its probes land on set bits.
+		for (x = 0; x < RH_FILTER_PROBES; x++)
+			fp *= fill;
+		dcb_lprintf(1, "hash stats: filter(%lu bytes), fill(%f%%), est. false positive rate(%f%%)\n",
+					words * sizeof(unsigned long long), fill * 100, fp * 100);
+	}
+}
+
+void print_RefHash_match_stats(RefHash *rhash)
+{
+	unsigned long total = rhash->good_matches + rhash->bad_matches;
+	dcb_lprintf(1, "match stats: good matches(%lu), bad matches(%lu), bad rate(%f%%)\n",
+				rhash->good_matches, rhash->bad_matches, (total ? (float)rhash->bad_matches / total * 100 : 0.0));
 }
@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (C) 2003-2015 Brian Harring <ferringb@gmail.com>
+
+/* suffix array construction via SA-IS (Nong, Zhang & Chan, "Two Efficient Algorithms for Linear
+   Time Suffix Array Construction").  The end of string sentinel the paper appends is kept
+   virtual- it sorts before every suffix and is never stored- so byte input can be used as is. */
+#include <stdlib.h>
+#include <string.h>
+#include <diffball/defs.h>
+#include <diffball/suffix.h>
+
+// suffix types; S if it sorts before the suffix following it, L otherwise.
+#define SA_TGET(t, i) (((t)[(i) >> 3] >> ((i)&7)) & 1)
+#define SA_TSET(t, i) ((t)[(i) >> 3] |= (unsigned char)(1 << ((i)&7)))
+// the virtual sentinel at n is always the start of an LMS run.
+#define SA_IS_LMS(t, i, n) ((i) == (n) || ((i) > 0 && SA_TGET((t), (i)) && !SA_TGET((t), (i)-1)))
+#define SA_CHR(s, cs, i) ((cs) ? ((const int *)(s))[(i)] : (int)((const unsigned char *)(s))[(i)])
+
+static void
+sa_buckets(const void *s, int cs, int *bkt, int n, int k, int end)
+{
+	int i, sum = 0;
+	memset(bkt, 0, k * sizeof(int));
+	for (i = 0; i < n; i++)
+		bkt[SA_CHR(s, cs, i)]++;
+	for (i = 0; i < k; i++)
+	{
+		sum += bkt[i];
+		bkt[i] = (end ? sum : sum - bkt[i]);
+	}
+}
+
+/* with the LMS suffixes (or their sorted order) in place, induce the L suffixes from the left,
+   then the S suffixes from the right.  The sentinel comes first; the suffix just before it is
+   the smallest L suffix. */
+static void
+sa_induce(const void *s, int cs, const unsigned char *t, int *sa, int *bkt, int n, int k)
+{
+	int i, j;
+	sa_buckets(s, cs, bkt, n, k, 0);
+	sa[bkt[SA_CHR(s, cs, n - 1)]++] = n - 1;
+	for (i = 0; i < n; i++)
+	{
+		j = sa[i] - 1;
+		if (j >= 0 && !SA_TGET(t, j))
+			sa[bkt[SA_CHR(s, cs, j)]++] = j;
+	}
+	sa_buckets(s, cs, bkt, n, k, 1);
+	for (i = n - 1; i >= 0; i--)
+	{
+		j = sa[i] - 1;
+		if (j >= 0 && SA_TGET(t, j))
+			sa[--bkt[SA_CHR(s, cs, j)]] = j;
+	}
+}
+
+// s is n chars over [0, k); cs is nonzero if they're ints rather than bytes.
+static signed int
+sa_is(const void *s, int cs, int *sa, int n, int k)
+{
+	unsigned char *t;
+	int *bkt, *s1;
+	int i, j, n1, name, prev, pos, d, diff;
+
+	if (n == 1)
+	{
+		sa[0] = 0;
+		return 0;
+	}
+	if ((t = (unsigned char *)calloc(n / 8 + 1, 1)) == NULL)
+		return MEM_ERROR;
+	// the last char is L, as the sentinel is smaller.
+	for (i = n - 2; i >= 0; i--)
+	{
+		if (SA_CHR(s, cs, i) < SA_CHR(s, cs, i + 1) ||
+			(SA_CHR(s, cs, i) == SA_CHR(s, cs, i + 1) && SA_TGET(t, i + 1)))
+			SA_TSET(t, i);
+	}
+
+	// stage 1: sort the LMS substrings by inducing from them in arbitrary order.
+	if ((bkt = (int *)malloc(k * sizeof(int))) == NULL)
+	{
+		free(t);
+		return MEM_ERROR;
+	}
+	sa_buckets(s, cs, bkt, n, k, 1);
+	for (i = 0; i < n; i++)
+		sa[i] = -1;
+	for (i = 1; i < n; i++)
+	{
+		if (SA_IS_LMS(t, i, n))
+			sa[--bkt[SA_CHR(s, cs, i)]] = i;
+	}
+	sa_induce(s, cs, t, sa, bkt, n, k);
+	free(bkt);
+
+	// pull the sorted LMS substrings to the front, and name them by equality.
+	for (i = 0, n1 = 0; i < n; i++)
+	{
+		if (SA_IS_LMS(t, sa[i], n))
+			sa[n1++] = sa[i];
+	}
+	for (i = n1; i < n; i++)
+		sa[i] = -1;
+	for (i = 0, name = 0, prev = -1; i < n1; i++)
+	{
+		pos = sa[i];
+		diff = (prev == -1);
+		for (d = 0; !diff; d++)
+		{
+			// only the sentinel's substring reaches n, and it's never in sa.
+			if (pos + d == n || prev + d == n || SA_CHR(s, cs, pos + d) != SA_CHR(s, cs, prev + d) ||
+				SA_TGET(t, pos + d) != SA_TGET(t, prev + d))
+				diff = 1;
+			else if (d > 0 && (SA_IS_LMS(t, pos + d, n) || SA_IS_LMS(t, prev + d, n)))
+				break;
+		}
+		if (diff)
+		{
+			name++;
+			prev = pos;
+		}
+		// LMS positions are at least two apart, so pos / 2 is unique.
+		sa[n1 + pos / 2] = name - 1;
+	}
+	for (i = n - 1, j = n - 1; i >= n1; i--)
+	{
+		if (sa[i] >= 0)
+			sa[j--] = sa[i];
+	}
+
+	// stage 2: sort the reduced problem, recursing unless every name is unique.
+	s1 = sa + n - n1;
+	if (name < n1)
+	{
+		if ((i = sa_is(s1, 1, sa, n1, name)) != 0)
+		{
+			free(t);
+			return i;
+		}
+	}
+	else
+	{
+		for (i = 0; i < n1; i++)
+			sa[s1[i]] = i;
+	}
+
+	// stage 3: map back to LMS positions, place them in sorted order, and induce the rest.
+	if ((bkt = (int *)malloc(k * sizeof(int))) == NULL)
+	{
+		free(t);
+		return MEM_ERROR;
+	}
+	for (i = 1, j = 0; i < n; i++)
+	{
+		if (SA_IS_LMS(t, i, n))
+			s1[j++] = i;
+	}
+	for (i = 0; i < n1; i++)
+		sa[i] = s1[sa[i]];
+	for (i = n1; i < n; i++)
+		sa[i] = -1;
+	sa_buckets(s, cs, bkt, n, k, 1);
+	for (i = n1 - 1; i >= 0; i--)
+	{
+		j = sa[i];
+		sa[i] = -1;
+		sa[--bkt[SA_CHR(s, cs, j)]] = j;
+	}
+	sa_induce(s, cs, t, sa, bkt, n, k);
+	free(bkt);
+	free(t);
+	return 0;
+}
+
+/* fill sa[0..len) with the starting offsets of buff's suffixes in sorted order; a suffix that's a
+   prefix of another sorts first.  len must be at most SUFFIX_MAX_LEN. */
+signed int
+suffix_array_build(const unsigned char *buff, int *sa, unsigned long len)
+{
+	if (len > SUFFIX_MAX_LEN)
+		return DATA_ERROR;
+	if (len == 0)
+		return 0;
+	return sa_is(buff, 0, sa, (int)len, 256);
+}
@@ -54,24 +54,52 @@ const unsigned long copy_soff_start[] = {
 	0x80 + 0x8000,
 	0x80 + 0x8000 + 0x800000};
 
-signed int switchingEncodeDCBuffer(CommandBuffer *buffer,
-								   cfile *out_cfh)
+/* write an add command; len must be <= SWITCHING_MAX_ADD_LEN.  Returns the bytes written. */
+static signed int
+switching_write_add(cfile *out_cfh, off_u64 len)
 {
-	off_u64 fh_pos = 0;
-	off_s64 s_off = 0;
-	off_u64 u_off = 0;
-	off_u32 delta_pos = 0, dc_pos = 0;
-	unsigned int lb;
-	signed int count;
-	unsigned int x, commands_processed;
-	unsigned char out_buff[256];
-	off_u64 temp_len;
-	DCommand_collapsed dcc;
-	off_u32 total_add_len = 0;
-	unsigned int last_com, temp;
+	unsigned char out_buff[8];
+	unsigned int lb, temp;
+	if (len >= add_len_start[3])
+	{
+		temp = 3;
+		lb = 30;
+	}
+	else if (len >= add_len_start[2])
+	{
+		temp = 2;
+		lb = 22;
+	}
+	else if (len >= add_len_start[1])
+	{
+		temp = 1;
+		lb = 14;
+	}
+	else
+	{
+		temp = 0;
+		lb = 6;
+	}
+	len -= add_len_start[temp];
+	writeUBitsBE(out_buff, len, lb);
+	out_buff[0] |= (temp << 6);
+	if (temp + 1 != cwrite(out_cfh, out_buff, temp + 1))
+	{
+		eprintf("Failed writing %u to the patch fileu\n", temp + 1);
+		return IO_ERROR;
+	}
+	return temp + 1;
+}
+
+/* write a copy command; len must be <= SWITCHING_MAX_COPY_LEN, and s_off (u_off for
+   ENCODING_OFFSET_START) within reach of the encoding.  Returns the bytes written. */
+static signed int
+switching_write_copy(cfile *out_cfh, off_u64 len, off_s64 s_off, off_u64 u_off, unsigned int offset_type)
+{
+	unsigned char out_buff[16];
+	unsigned int lb, temp;
 	unsigned int is_neg = 0;
 	unsigned const long *copy_off_array;
-	unsigned int offset_type = ENCODING_OFFSET_DC_POS;
 	if (offset_type == ENCODING_OFFSET_DC_POS)
 	{
 		copy_off_array = copy_soff_start;
@@ -80,6 +108,98 @@ signed int switchingEncodeDCBuffer(CommandBuffer *buffer,
 	{
 		copy_off_array = copy_off_start;
 	}
+	if (len >= copy_len_start[3])
+	{
+		temp = 3;
+		lb = 28;
+	}
+	else if (len >= copy_len_start[2])
+	{
+		temp = 2;
+		lb = 20;
+	}
+	else if (len >= copy_len_start[1])
+	{
+		temp = 1;
+		lb = 12;
+	}
+	else
+	{
+		temp = 0;
+		lb = 4;
+	}
+	len -= copy_len_start[temp];
+	writeUBitsBE(out_buff, len, lb);
+	out_buff[0] |= (temp << 6);
+	lb = temp + 1;
+
+	if (offset_type == ENCODING_OFFSET_DC_POS)
+	{
+		u_off = llabs(s_off);
+	}
+	if (u_off >= copy_off_array[3])
+	{
+		temp = 3;
+	}
+	else if (u_off >= copy_off_array[2])
+	{
+		temp = 2;
+	}
+	else if (u_off >= copy_off_array[1])
+	{
+		temp = 1;
+	}
+	else
+	{
+		temp = 0;
+	}
+	out_buff[0] |= (temp << 4);
+	if (offset_type == ENCODING_OFFSET_DC_POS)
+	{
+		if (temp)
+		{
+			if (s_off > 0)
+			{
+				s_off -= copy_off_array[temp];
+			}
+			else
+			{
+				s_off += copy_off_array[temp];
+				is_neg = 1;
+			}
+		}
+		writeSBytesBE(out_buff + lb, s_off, temp + 1);
+		if (is_neg)
+			out_buff[lb] |= 0x80;
+	}
+	else
+	{
+		u_off -= copy_off_array[temp];
+		writeUBytesBE(out_buff + lb, u_off, temp + 1);
+	}
+	if (lb + temp + 1 != cwrite(out_cfh, out_buff, lb + temp + 1))
+	{
+		eprintf("Failed writing to the patch file\n");
+		return IO_ERROR;
+	}
+	return lb + temp + 1;
+}
+
+signed int switchingEncodeDCBuffer(CommandBuffer *buffer,
+								   cfile *out_cfh)
+{
+	off_u64 fh_pos = 0;
+	off_s64 s_off = 0;
+	off_u64 u_off = 0;
+	off_u64 delta_pos = 0, dc_pos = 0;
+	signed int count, err;
+	unsigned int x, commands_processed;
+	unsigned char out_buff[256];
+	off_u64 temp_len, len;
+	DCommand_collapsed dcc;
+	off_u64 total_add_len = 0;
+	unsigned int last_com;
+	unsigned int offset_type = ENCODING_OFFSET_DC_POS;
 	if (init_DCommand_collapsed(&dcc))
 	{
 		return MEM_ERROR;
@@ -110,6 +230,12 @@ signed int switchingEncodeDCBuffer(CommandBuffer *buffer,
 	if (count != 0)
 		return count;
 
+	if (total_add_len > SWITCHING_MAX_TOTAL_ADD_LEN)
+	{
+		eprintf("%llu bytes of new content is more than the switching format can hold\n",
+				(act_off_u64)total_add_len);
+		return FORMAT_ERROR;
+	}
 	writeUBytesBE(out_buff, total_add_len, 4);
 	cwrite(out_cfh, out_buff, 4);
 	delta_pos += 4;
@@ -146,148 +272,75 @@ signed int switchingEncodeDCBuffer(CommandBuffer *buffer,
 	{
 		if (DC_ADD == dcc.commands[0].type)
 		{
-			temp_len = dcc.len;
-			if (temp_len >= add_len_start[3])
-			{
-				temp = 3;
-				lb = 30;
-			}
-			else if (temp_len >= add_len_start[2])
-			{
-				temp = 2;
-				lb = 22;
-			}
-			else if (temp_len >= add_len_start[1])
+			// longer than one command holds; split it, w/ empty copies between the pieces.
+			for (temp_len = dcc.len; temp_len > SWITCHING_MAX_ADD_LEN; temp_len -= SWITCHING_MAX_ADD_LEN)
 			{
-				temp = 1;
-				lb = 14;
-			}
-			else
-			{
-				temp = 0;
-				lb = 6;
-			}
-			temp_len -= add_len_start[temp];
-			writeUBitsBE(out_buff, temp_len, lb);
-			out_buff[0] |= (temp << 6);
-			if (temp + 1 != cwrite(out_cfh, out_buff, temp + 1))
-			{
-				eprintf("Failed writing %u to the patch fileu\n", temp + 1);
-				return IO_ERROR;
+				if ((err = switching_write_add(out_cfh, SWITCHING_MAX_ADD_LEN)) < 0)
+					return err;
+				delta_pos += err;
+				// nudged off of 0 so it can't read as the end of patch marker.
+				s_off = (dc_pos == 0 ? 1 : 0);
+				if ((err = switching_write_copy(out_cfh, 0, s_off, 1, offset_type)) < 0)
+					return err;
+				dc_pos += s_off;
+				delta_pos += err;
 			}
-			dcb_lprintf(2, "writing add, pos(%u), len(%u)\n", delta_pos, dcc.len);
-			delta_pos += temp + 1;
+			if ((err = switching_write_add(out_cfh, temp_len)) < 0)
+				return err;
+			dcb_lprintf(2, "writing add, pos(%llu), len(%llu)\n", (act_off_u64)delta_pos, (act_off_u64)dcc.len);
+			delta_pos += err;
 			fh_pos += dcc.len;
 			last_com = DC_ADD;
 			commands_processed = count;
 		}
 		else
 		{
-			if (last_com == DC_COPY)
-			{
-				dcb_lprintf(2, "last command was a copy, outputing blank add\n");
-				out_buff[0] = 0;
-				if (1 != cwrite(out_cfh, out_buff, 1))
-				{
-					eprintf("Failed writing to the patch file\n");
-					return IO_ERROR;
-				}
-				delta_pos++;
-			}
-
-			//yes this is a hack.  but it works.
-			if (offset_type == ENCODING_OFFSET_DC_POS)
-			{
-				s_off = dcc.commands[commands_processed].data.src_pos - dc_pos;
-				u_off = abs(s_off);
-				dcb_lprintf(2, "off(%llu), dc_pos(%u), u_off(%llu), s_off(%lld): ",
-							(act_off_u64)dcc.commands[commands_processed].data.src_pos,
-							dc_pos, (act_off_u64)u_off, (act_off_s64)s_off);
-			}
-			else
-			{
-				u_off = dcc.commands[commands_processed].data.src_pos;
-			}
+			u_off = dcc.commands[commands_processed].data.src_pos;
 			temp_len = dcc.commands[commands_processed].data.len;
-			if (temp_len >= copy_len_start[3])
+			while (temp_len)
 			{
-				temp = 3;
-				lb = 28;
-			}
-			else if (temp_len >= copy_len_start[2])
-			{
-				temp = 2;
-				lb = 20;
-			}
-			else if (temp_len >= copy_len_start[1])
-			{
-				temp = 1;
-				lb = 12;
-			}
-			else
-			{
-				temp = 0;
-				lb = 4;
-			}
-			temp_len -= copy_len_start[temp];
-			writeUBitsBE(out_buff, temp_len, lb);
-			out_buff[0] |= (temp << 6);
-			lb = temp + 1;
-
-			if (u_off >= copy_off_array[3])
-			{
-				temp = 3;
-			}
-			else if (u_off >= copy_off_array[2])
-			{
-				temp = 2;
-			}
-			else if (u_off >= copy_off_array[1])
-			{
-				temp = 1;
-			}
-			else
-			{
-				temp = 0;
-			}
-			out_buff[0] |= (temp << 4);
-			if (offset_type == ENCODING_OFFSET_DC_POS)
-			{
-				dc_pos += s_off;
-				if (temp)
+				if (last_com == DC_COPY)
 				{
-					if (s_off > 0)
+					dcb_lprintf(2, "last command was a copy, outputing blank add\n");
+					out_buff[0] = 0;
+					if (1 != cwrite(out_cfh, out_buff, 1))
 					{
-						s_off -= copy_off_array[temp];
-						is_neg = 0;
+						eprintf("Failed writing to the patch file\n");
+						return IO_ERROR;
 					}
-					else
+					delta_pos++;
+				}
+				len = MIN(temp_len, SWITCHING_MAX_COPY_LEN);
+
+				//yes this is a hack.  but it works.
+				if (offset_type == ENCODING_OFFSET_DC_POS)
+				{
+					s_off = (off_s64)(u_off - dc_pos);
+					// further than one command can move dc_pos; hop toward it w/ an empty copy.
+					if (s_off > SWITCHING_MAX_OFF_DELTA || s_off < -SWITCHING_MAX_OFF_DELTA)
 					{
-						s_off += copy_off_array[temp];
-						is_neg = 1;
+						s_off = (s_off > 0 ? SWITCHING_MAX_OFF_DELTA : -SWITCHING_MAX_OFF_DELTA);
+						len = 0;
 					}
+					dcb_lprintf(2, "off(%llu), dc_pos(%llu), s_off(%lld): ",
+								(act_off_u64)u_off, (act_off_u64)dc_pos, (act_off_s64)s_off);
+					dc_pos += s_off;
 				}
-				writeSBytesBE(out_buff + lb, s_off, temp + 1);
-				if (is_neg)
-					out_buff[lb] |= 0x80;
-				is_neg = 0;
-			}
-			else
-			{
-				u_off -= copy_off_array[temp];
-				writeUBytesBE(out_buff + lb, u_off, temp + 1);
-			}
-			if (lb + temp + 1 != cwrite(out_cfh, out_buff, lb + temp + 1))
-			{
-				eprintf("Failed writing to the patch file\n");
-				return IO_ERROR;
+				else if (u_off > SWITCHING_MAX_ABS_OFFSET)
+				{
+					eprintf("copy offset %llu is past what the switching format can address\n", (act_off_u64)u_off);
+					return FORMAT_ERROR;
+				}
+				if ((err = switching_write_copy(out_cfh, len, s_off, u_off, offset_type)) < 0)
+					return err;
+				dcb_lprintf(2, "writing copy delta_pos(%llu), fh_pos(%llu), len(%llu)\n",
+							(act_off_u64)delta_pos, (act_off_u64)fh_pos, (act_off_u64)len);
+				delta_pos += err;
+				fh_pos += len;
+				last_com = DC_COPY;
+				u_off += len;
+				temp_len -= len;
 			}
-			dcb_lprintf(2, "writing copy delta_pos(%u), fh_pos(%llu), offset(%lld), len(%u)\n",
-						delta_pos, (act_off_u64)fh_pos, (act_off_s64)ENCODING_OFFSET_DC_POS,
-						dcc.commands[commands_processed].data.len);
-			fh_pos += dcc.commands[commands_processed].data.len;
-			delta_pos += lb + temp + 1;
-			last_com = DC_COPY;
 		}
 		commands_processed++;
 		if (commands_processed >= count)
@@ -321,12 +374,13 @@ switchingReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbu
 {
 	const unsigned int buff_size = 4096;
 	unsigned char buff[buff_size];
-	off_u32 len;
-	off_u32 dc_pos = 0;
+	off_u64 len;
+	off_u64 dc_pos = 0;
 	off_u64 u_off;
 	off_s64 s_off;
 	off_u32 last_com;
-	off_u32 add_off, com_start;
+	off_u64 add_off;
+	off_u32 com_start;
 	unsigned int ob, lb;
 	unsigned int end_of_patch = 0;
 	unsigned const long *copy_off_array;
@@ -364,12 +418,12 @@ switchingReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbu
 		eprintf("Internal error: failed registering the patch into the command buffer: %i\n", add_id);
 		return add_id;
 	}
-	dcb_lprintf(2, "add data block size(%u), starting commands at pos(%u)\n", com_start,
-				(off_u32)ctell(patchf, CSEEK_ABS));
+	dcb_lprintf(2, "add data block size(%u), starting commands at pos(%llu)\n", com_start,
+				(act_off_u64)ctell(patchf, CSEEK_ABS));
 
 	while (end_of_patch == 0 && cread(patchf, buff, 1) == 1)
 	{
-		dcb_lprintf(2, "processing(%u) at pos(%u): ", buff[0], (off_u32)ctell(patchf, CSEEK_ABS) - 1);
+		dcb_lprintf(2, "processing(%u) at pos(%llu): ", buff[0], (act_off_u64)ctell(patchf, CSEEK_ABS) - 1);
 		if (last_com != DC_ADD)
 		{
 			lb = (buff[0] >> 6) & 0x3;
@@ -386,7 +440,7 @@ switchingReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbu
 				add_off += len;
 			}
 			last_com = DC_ADD;
-			dcb_lprintf(2, "add len(%u)\n", len);
+			dcb_lprintf(2, "add len(%llu)\n", (act_off_u64)len);
 		}
 		else if (last_com != DC_COPY)
 		{
@@ -415,7 +469,7 @@ switchingReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbu
 					s_off += copy_off_array[ob];
 				}
 				u_off = dc_pos + s_off;
-				dcb_lprintf(2, "u_off(%llu), dc_pos(%u), s_off(%lld): ", (act_off_u64)u_off, dc_pos, (act_off_s64)s_off);
+				dcb_lprintf(2, "u_off(%llu), dc_pos(%llu), s_off(%lld): ", (act_off_u64)u_off, (act_off_u64)dc_pos, (act_off_s64)s_off);
 				dc_pos = u_off;
 			}
 			else
@@ -434,7 +488,7 @@ switchingReconstructDCBuff(DCB_SRC_ID src_id, cfile *patchf, CommandBuffer *dcbu
 				DCB_add_copy(dcbuff, u_off, 0, len, src_id);
 			}
 			last_com = DC_COPY;
-			dcb_lprintf(2, "copy off(%llu), len(%u)\n", (act_off_u64)u_off, len);
+			dcb_lprintf(2, "copy off(%llu), len(%llu)\n", (act_off_u64)u_off, (act_off_u64)len);
 		}
 	}
 	dcbuff->ver_size = dcbuff->reconstruct_pos;
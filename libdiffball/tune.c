@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (C) 2003-2015 Brian Harring <ferringb@gmail.com>
+#include <stdio.h>
+#include <unistd.h>
+#include <diffball/defs.h>
+#include <diffball/cdc.h>
+#include <diffball/diff-algs.h>
+#include <diffball/tune.h>
+
+static unsigned long long
+read_cgroup_limit(const char *path)
+{
+	FILE *f;
+	unsigned long long limit = 0;
+	if ((f = fopen(path, "r")) == NULL)
+		return 0;
+	// v2 writes "max" when there's no limit, which doesn't scan.
+	if (fscanf(f, "%llu", &limit) != 1)
+		limit = 0;
+	fclose(f);
+	return limit;
+}
+
+/* the lesser of physical memory and the cgroup (v2, else v1) limit, in bytes; 0 if neither could
+   be read.  v1 reports no limit as a huge value, which physical memory caps. */
+unsigned long
+diff_memory_limit(void)
+{
+	unsigned long long limit = 0, cg;
+	long pages = sysconf(_SC_PHYS_PAGES), page_size = sysconf(_SC_PAGE_SIZE);
+	if (pages > 0 && page_size > 0)
+		limit = (unsigned long long)pages * page_size;
+	if ((cg = read_cgroup_limit("/sys/fs/cgroup/memory.max")) == 0)
+		cg = read_cgroup_limit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+	if (cg && (limit == 0 || cg < limit))
+		limit = cg;
+	return (unsigned long)MIN(limit, ULONG_MAX);
+}
+
+/* size the hash so it and the matches fit the budget, then sample the reference so the forward
+   pass doesn't overfill it.  The suffix matcher is picked when it fits both the budget and
+   DEFAULT_SUFFIX_MEMORY, past which it's slower than MultiPass for no smaller patch; streaming
+   only when not even a minimal hash fits. */
+void
+diff_tune(diff_tuning *tune, off_u64 ref_len, off_u64 ver_len)
+{
+	unsigned long fixed, hash_mem;
+	const char *source = "given";
+	if (tune->mem_budget == 0)
+	{
+		source = "detected";
+		if ((tune->mem_budget = diff_memory_limit() / TUNE_MEMORY_SHARE) == 0)
+		{
+			source = "default";
+			tune->mem_budget = DEFAULT_TUNE_MEMORY;
+		}
+	}
+	fixed = TUNE_BASE_MEMORY + (ver_len / TUNE_MATCH_SPACING) * TUNE_MATCH_BYTES +
+			((ref_len + ver_len) / CDC_AVG_CHUNK) * sizeof(cdc_chunk);
+	hash_mem = (tune->mem_budget > fixed ? tune->mem_budget - fixed : 0);
+
+	if (tune->hash_size == 0)
+	{
+		tune->hash_size = MIN(MIN(ref_len, TUNE_MAX_HASH_ENTRIES), hash_mem / TUNE_HASH_ENTRY_BYTES);
+		tune->hash_size = MAX(tune->hash_size, MIN_RHASH_SIZE);
+	}
+	if (tune->seed_len == 0)
+	{
+		// keep the forward pass's samples under half a seed apart, so it still finds what it's after.
+		tune->seed_len = DEFAULT_MULTIPASS_SEED_LEN;
+		while (ref_len / tune->hash_size > tune->seed_len / 2 && tune->seed_len < TUNE_MAX_SEED_LEN)
+			tune->seed_len *= 2;
+	}
+	if (tune->sample_rate == 0)
+	{
+		tune->sample_rate = COMPUTE_SAMPLE_RATE(tune->hash_size, ref_len, tune->seed_len);
+		tune->sample_rate = MIN(tune->sample_rate, MAX_SAMPLE_RATE);
+	}
+
+	if (ref_len <= SUFFIX_MAX_LEN && SUFFIX_ALG_MEMORY(ref_len, ver_len) <= DEFAULT_SUFFIX_MEMORY &&
+		SUFFIX_ALG_MEMORY(ref_len, ver_len) + fixed <= tune->mem_budget)
+		tune->alg = DIFF_TUNE_SUFFIX;
+	else if (hash_mem < MIN_RHASH_SIZE * TUNE_HASH_ENTRY_BYTES || ref_len / tune->hash_size > MAX_SAMPLE_RATE)
+		tune->alg = DIFF_TUNE_STREAM;
+	else
+		tune->alg = DIFF_TUNE_MULTIPASS;
+	dcb_lprintf(1, "tuned for %s memory(%luMiB): %s, seed_len(%lu), hash_size(%lu), sample_rate(%lu)\n", source,
+				tune->mem_budget >> 20,
+				(tune->alg == DIFF_TUNE_SUFFIX ? "suffix" : (tune->alg == DIFF_TUNE_STREAM ? "streaming" : "multipass")),
+				tune->seed_len, tune->hash_size, tune->sample_rate);
+}
@@ -27,25 +27,28 @@ struct usage_options
 #define OSEED 'b'
 #define OSAMPLE 's'
 #define OHASH 'a'
+#define OTHREADS 'p'
 #define OSTDOUT 'c'
 #define OBZIP2 'j'
 #define OGZIP 'z'
 
 #define DIFF_SHORT_OPTIONS \
-	"b:s:a:"
+	"b:s:a:p:"
 
 #define DIFF_LONG_OPTIONS               \
 	{"seed-len", 1, 0, OSEED},          \
 		{"sample-rate", 1, 0, OSAMPLE}, \
+		{"hash-size", 1, 0, OHASH},     \
 	{                                   \
-		"hash-size", 1, 0, OHASH        \
+		"threads", 1, 0, OTHREADS       \
 	}
 
-#define DIFF_HELP_OPTIONS                                \
-	{OSEED, "seed-len", "set the seed len"},             \
-		{OSAMPLE, "sample-rate", "set the sample rate"}, \
-	{                                                    \
-		OHASH, "hash-size", "set the hash size"          \
+#define DIFF_HELP_OPTIONS                                      \
+	{OSEED, "seed-len", "set the seed len"},                   \
+		{OSAMPLE, "sample-rate", "set the sample rate"},       \
+		{OHASH, "hash-size", "set the hash size"},             \
+	{                                                          \
+		OTHREADS, "threads", "number of threads to match with" \
 	}
 
 #define STD_SHORT_OPTIONS \
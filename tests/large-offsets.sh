@@ -0,0 +1,55 @@
+#!/bin/sh
+# round trip a gdiff patch against a sparse reference past 4GiB, so every copy has to carry an
+# offset that doesn't fit in 32 bits.  Exits 77 (skipped) if the build directory's filesystem
+# can't hold a sparse file, or lacks the few MiB of real space the test needs.
+#
+# the reference is mostly a hole; differ still reads and hashes all of it, so expect this to
+# take a minute or two.
+
+builddir=${builddir:-.}
+ref_mib=4100
+chunk_mib=4097
+
+skip()
+{
+	echo "skipping: $*"
+	exit 77
+}
+
+fail()
+{
+	echo "FAIL: $*"
+	exit 1
+}
+
+command -v truncate > /dev/null 2>&1 || skip "no truncate"
+avail=$(df -Pk . 2> /dev/null | awk 'NR == 2 {print $4}')
+[ -n "$avail" ] && [ "$avail" -ge 16384 ] || skip "less than 16MiB free"
+
+work=$(mktemp -d "./large-offsets.XXXXXX") || skip "can't create a scratch directory"
+trap 'rm -rf "$work"' EXIT
+trap 'exit 1' HUP INT TERM
+
+truncate -s "${ref_mib}M" "$work/ref" 2> /dev/null || skip "can't create a ${ref_mib}MiB sparse file"
+used=$(du -k "$work/ref" | awk '{print $1}')
+[ "$used" -lt 1024 ] || skip "filesystem doesn't support sparse files"
+
+# 1MiB of noise just past 4GiB, and a version of its halves swapped followed by some of the hole.
+# it's all matchable; new data would send the later passes back over the whole reference.
+head -c 1048576 /dev/urandom > "$work/chunk" || fail "can't read /dev/urandom"
+dd if="$work/chunk" of="$work/ref" bs=1048576 seek=$chunk_mib conv=notrunc 2> /dev/null ||
+	fail "can't write into the sparse reference"
+{
+	tail -c 524288 "$work/chunk"
+	head -c 524288 "$work/chunk"
+	head -c 1048576 /dev/zero
+} > "$work/ver"
+
+"$builddir/differ" "$work/ref" "$work/ver" "$work/patch" -f gdiff4 || fail "differ failed"
+"$builddir/patcher" "$work/ref" "$work/patch" "$work/out" || fail "patcher failed"
+cmp "$work/ver" "$work/out" || fail "reconstructed version differs"
+# the copies must have come from past 4GiB; a patch of mostly adds would also round trip.
+size=$(wc -c < "$work/patch")
+[ "$size" -lt 65536 ] || fail "patch is $size bytes; copies from past 4GiB weren't found"
+echo "ok, patch is $size bytes"
+exit 0